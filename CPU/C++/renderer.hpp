@@ -1,19 +1,35 @@
 #pragma once
 
 #include <SDL2/SDL.h>
-#include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <stdexcept>
+#include <vector>
+
+#include <omp.h>
 
 #include "colormap.h"
-#include <kwk/kwk.hpp>
 
 using real = float;  // or double, if preferred
 
 class Renderer {
 public:
-    Renderer(std::size_t width, std::size_t height) : width(width), height(height)
+    // The window shows the whole grid, scaled by an integer factor keeping
+    // its aspect ratio : reduced until it fits, magnified up to the min size.
+    // A very elongated grid keeps at least a pixel along its short side
+    Renderer(std::size_t d0, std::size_t d1) : grid_rows(d0), grid_cols(d1)
     {
+        const std::size_t reduce = std::max({ std::size_t{1}, (d0 + max_width - 1) / max_width,
+                                              (d1 + max_height - 1) / max_height });
+        const std::size_t grow   = std::min(std::max((min_width + d0 - 1) / d0, (min_height + d1 - 1) / d1),
+                                            std::min(max_width / d0, max_height / d1));
+        width   = (reduce > 1) ? std::max(d0 / reduce, std::size_t{1}) : d0 * std::max(grow, std::size_t{1});
+        height  = (reduce > 1) ? std::max(d1 / reduce, std::size_t{1}) : d1 * std::max(grow, std::size_t{1});
+
+        row_starts.resize(width + 1);
+        row_sums.resize(static_cast<std::size_t>(render_threads) * (grid_rows + 1));
+
         if (SDL_Init(SDL_INIT_VIDEO) < 0)
             throw std::runtime_error("SDL could not initialize!");
     
@@ -22,7 +38,9 @@ public:
 
         window      = SDL_CreateWindow("Gray Scott", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                               SDL_width, SDL_height, SDL_WINDOW_SHOWN);
-        renderer    = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+        // render returns at the refresh of the screen, which paces the
+        // display loop of main
+        renderer    = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
         texture     = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
                                 SDL_TEXTUREACCESS_STREAMING, SDL_width, SDL_height);
     }
@@ -35,42 +53,185 @@ public:
         SDL_Quit();
     }
 
-    template<kwk::concepts::container Container>
-    void render(std::size_t d0, std::size_t d1, Container const& grid)
+    // grid holds d0 x d1 values, row major, the grid rows being the image
+    // columns. A pixel is the mean of the cells of the view it covers, or
+    // the cell it falls in once zoomed past one cell per pixel. For an image
+    // row, the columns of its cells are summed for every row of the view,
+    // these sums being accumulated along the rows : a pixel is then the
+    // difference of two of them, gathered W pixels at a time
+    void render(std::size_t d0, std::size_t d1, real const* grid)
     {
-        if (d0 != width || d1 != height)
+        if (d0 != grid_rows || d1 != grid_cols)
             throw std::runtime_error("Grid size mismatch");
 
-        std::vector<std::uint32_t> pixels(width * height);
-        auto pixel_table = kwk::view{ kwk::source = pixels, kwk::of_size(d0, d1), kwk::with_strides(1, d0) };
-        
-        kwk::transform(kwk::cpu, [&](auto e)
+        // Pixels go straight into the texture memory, whose rows may be padded
+        void* texels    = nullptr;
+        int pitch       = 0;
+        if (SDL_LockTexture(texture, nullptr, &texels, &pitch) < 0)
+            throw std::runtime_error(SDL_GetError());
+
+        const std::size_t view_rows = grid_rows >> zoom;
+        const std::size_t view_cols = grid_cols >> zoom;
+        const auto first_row        = static_cast<std::size_t>(view_row);
+        const auto first_col        = static_cast<std::size_t>(view_col);
+
+        // A pixel column covers the view rows [row_starts[x], row_starts[x + 1]),
+        // at least one of them
+        std::size_t* starts = row_starts.data();
+        for (std::size_t x = 0; x <= width; ++x)
+            starts[x] = x * view_rows / width;
+
+        #pragma omp parallel num_threads(render_threads)
         {
-            std::uint32_t value = 0;
+            double* sums = row_sums.data() + static_cast<std::size_t>(omp_get_thread_num()) * (grid_rows + 1);
 
-            if(e < 0.0f)
-                value = 0;
-             else if(e > 1.0f)
-                 value = 1;
-             else
-                 value = static_cast<std::uint32_t>(e * 2.0f * 255.0f);
+            #pragma omp for schedule(static)
+            for (std::size_t y = 0; y < height; ++y)
+            {
+                const std::size_t c0 = first_col + y * view_cols / height;
+                const std::size_t c1 = std::max(first_col + (y + 1) * view_cols / height, c0 + 1);
 
-            return colormap[value];
-        }, pixel_table, grid);
+                // In double, so that the difference of two sums far along
+                // the view keeps the precision of a single pixel
+                double running = 0.0;
+                sums[0]        = 0.0;
+                for (std::size_t r = 0; r < view_rows; ++r)
+                {
+                    real const* cells = grid + (first_row + r) * d1;
+                    real sum = 0;
+                    #pragma omp simd reduction(+:sum)
+                    for (std::size_t c = c0; c < c1; ++c)
+                        sum += cells[c];
+                    running     += sum;
+                    sums[r + 1]  = running;
+                }
 
-        SDL_UpdateTexture(texture, nullptr, pixels.data(), d0 * sizeof(std::uint32_t));
-        SDL_Delay(5);
+                auto* image_row = reinterpret_cast<std::uint32_t*>(static_cast<std::uint8_t*>(texels)
+                                                                   + y * static_cast<std::size_t>(pitch));
+                const double cols = static_cast<double>(c1 - c0);
+
+                #pragma omp simd
+                for (std::size_t x = 0; x < width; ++x)
+                {
+                    const std::size_t r0 = starts[x];
+                    const std::size_t r1 = std::max(starts[x + 1], r0 + 1);
+                    const double mean    = (sums[r1] - sums[r0]) / (static_cast<double>(r1 - r0) * cols);
+                    image_row[x] = color_of(static_cast<real>(mean));
+                }
+            }
+        }
+        view_moved = false;
+
+        SDL_UnlockTexture(texture);
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
     }
 
+    // Handles the pending events, false once the window was closed. The
+    // mouse wheel zooms around the cursor, dragging with the left button
+    // pans and r goes back to the whole grid
+    bool poll()
+    {
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            const double rows_per_pixel = static_cast<double>(grid_rows >> zoom) / static_cast<double>(width);
+            const double cols_per_pixel = static_cast<double>(grid_cols >> zoom) / static_cast<double>(height);
+
+            if (event.type == SDL_QUIT)
+            {
+                open = false;
+            }
+            else if (event.type == SDL_MOUSEWHEEL)
+            {
+                const unsigned previous = zoom;
+                if (event.wheel.y > 0 && (grid_rows >> (zoom + 1)) >= min_view_cells
+                                      && (grid_cols >> (zoom + 1)) >= min_view_cells)
+                    ++zoom;
+                else if (event.wheel.y < 0 && zoom > 0)
+                    --zoom;
+
+                // The cell under the cursor stays where it is
+                int mouse_x = 0;
+                int mouse_y = 0;
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+
+                const double scale = zoom > previous ? 0.5 : (zoom < previous ? 2.0 : 1.0);
+                view_row += mouse_x * rows_per_pixel * (1.0 - scale);
+                view_col += mouse_y * cols_per_pixel * (1.0 - scale);
+                move_view();
+            }
+            else if (event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_LMASK))
+            {
+                view_row -= event.motion.xrel * rows_per_pixel;
+                view_col -= event.motion.yrel * cols_per_pixel;
+                move_view();
+            }
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r)
+            {
+                zoom        = 0;
+                view_row    = 0.0;
+                view_col    = 0.0;
+                move_view();
+            }
+        }
+        return open;
+    }
+
+    // The view changed since the last render
+    bool moved() const { return view_moved; }
 
 private:
+    static constexpr std::size_t min_width      = 640;
+    static constexpr std::size_t min_height     = 360;
+    static constexpr std::size_t max_width      = 1920;
+    static constexpr std::size_t max_height     = 1080;
+    static constexpr std::size_t min_view_cells = 16;
+
+    // Team of the display thread, while the simulation thread steps on
+    static constexpr int render_threads = 2;
+
+    // v = 0.5 takes the last colour
+    static constexpr real colormap_last     = static_cast<real>(std::size(colormap) - 1);
+    static constexpr real colormap_scale    = 2 * colormap_last;
+
+    // Inlined in the simd pixel loop of render : selects rather than
+    // branches, and a signed index, which gcc converts lane-wise
+    static std::uint32_t color_of(real v)
+    {
+        real x = v * colormap_scale;
+        x = x < real{0} ? real{0} : x;
+        x = x > colormap_last ? colormap_last : x;
+        return colormap[static_cast<std::int32_t>(x)];
+    }
+
+    // Keeps the view inside the grid
+    void move_view()
+    {
+        view_row    = std::clamp(view_row, 0.0, static_cast<double>(grid_rows - (grid_rows >> zoom)));
+        view_col    = std::clamp(view_col, 0.0, static_cast<double>(grid_cols - (grid_cols >> zoom)));
+        view_moved  = true;
+    }
+
     SDL_Window* window      = nullptr;
     SDL_Renderer* renderer  = nullptr;
     SDL_Texture* texture    = nullptr;
+    std::size_t grid_rows;
+    std::size_t grid_cols;
     std::size_t width;
     std::size_t height;
-};
+    bool open = true;
+
+    // Where the pixel columns start, and per render thread the sums of the
+    // image row being drawn, accumulated along the rows of the view
+    std::vector<std::size_t> row_starts;
+    std::vector<double> row_sums;
 
+    // The window shows the grid divided by 2^zoom along both axes, from
+    // the cell (view_row, view_col)
+    unsigned zoom       = 0;
+    double view_row     = 0.0;
+    double view_col     = 0.0;
+    bool view_moved     = false;
+};
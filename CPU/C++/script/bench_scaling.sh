@@ -0,0 +1,30 @@
+#!/bin/sh
+# Strong scaling of the C++ engine : same grid, 1 to nproc threads.
+# Usage : script/bench_scaling.sh [rows] [cols] [steps]
+# Build first with cmake in ./build, run from the CPU/C++ directory.
+
+BIN=${BIN:-./build/simulation}
+ROWS=${1:-4096}
+COLS=${2:-4096}
+STEPS=${3:-100}
+
+THREADS=$(nproc)
+
+echo "$THREADS threads, $ROWS x $COLS, $STEPS steps"
+echo "threads time(s) speedup efficiency"
+
+BASE=""
+T=1
+while [ "$T" -le "$THREADS" ]; do
+    TIME=$(OMP_NUM_THREADS=$T OMP_PLACES=cores OMP_PROC_BIND=close \
+           $BIN "$ROWS" "$COLS" "$STEPS" 0 | sed -n 's/.* steps in \([0-9.]*\) s.*/\1/p')
+    [ -z "$BASE" ] && BASE=$TIME
+
+    echo "$T $TIME $BASE" | awk '{ printf "%7d %7.3f %7.2f %9.1f%%\n", $1, $2, $3 / $2, 100 * $3 / ($2 * $1) }'
+
+    if [ "$T" -lt "$THREADS" ] && [ $((T * 2)) -gt "$THREADS" ]; then
+        T=$THREADS
+    else
+        T=$((T * 2))
+    fi
+done
@@ -5,12 +5,21 @@
 #include <numeric>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
+#include <array>
+#include <utility>
+#include <thread>
+#include <atomic>
+
+#include <omp.h>
 
 #include <kwk/kwk.hpp>
 #include "tile.hpp"
+#include "stencil.hpp"
 #include <eve/eve.hpp>
 
 #include "renderer.hpp"
+#include "triple_buffer.hpp"
 
 using real = float;
 using wide_t = eve::wide<real>; 
@@ -24,20 +33,29 @@ constexpr real DT               { 1.0f   };
 constexpr real DIFFUSION_RATE_U { 0.1f   };
 constexpr real DIFFUSION_RATE_V { 0.05f  };
 
+// Laplacian of the diffusion, five_points<real> or cross_radius_2<real>
+// can be swapped in without touching the kernels
+constexpr auto STENCIL = nine_points<real>;
+
 // Representing the offset from the sides of the simulation, 
 // boundary conditions are defined as 0 everywhere   
-constexpr std::size_t PADDING = 1;
-
-/*
-    | 0.25 | 0.5 | 0.25 |
-    |  0.5 | 0.0 | 0.5  |
-    | 0.25 | 0.5 | 0.25 |
-*/
-constexpr real STENCIL_WEIGHTS[]    = { 0.25f, 0.5f, 0.25f, 0.5f, 0.0f, 0.5f, 0.25f, 0.5f, 0.25f };
-constexpr auto stencil_shape        = kwk::of_size(3_c, 3_c);
-// Due to tiling we need a 4D view on the weights, that s how the indexing works in the algos
-constexpr auto weights = kwk::view{ kwk::source = STENCIL_WEIGHTS, kwk::of_size(1_c, 1_c, 3_c, 3_c) };
+constexpr std::size_t PADDING       = STENCIL.radius;
+constexpr std::size_t STENCIL_SIZE  = 2 * PADDING + 1;
+
+// Rows of the region are processed by bands of ROW_BLOCK rows, 
+// split between the OpenMP threads with a static schedule
+constexpr std::size_t ROW_BLOCK = 32;
+
+constexpr std::size_t LANES = static_cast<std::size_t>(wide_t::size());
 
+// Largest difference allowed between the SIMD and the scalar kernels
+constexpr real CHECK_TOLERANCE { 1e-5f };
+
+constexpr auto STENCIL_WEIGHTS      = STENCIL.dense();
+constexpr auto stencil_shape        = kwk::of_size(kwk::fixed<STENCIL_SIZE>, kwk::fixed<STENCIL_SIZE>);
+// Due to tiling we need a 4D view on the weights, that s how the indexing works in the algos
+constexpr auto weights = kwk::view{ kwk::source = STENCIL_WEIGHTS.data(), 
+                                    kwk::of_size(1_c, 1_c, kwk::fixed<STENCIL_SIZE>, kwk::fixed<STENCIL_SIZE>) };
 
 template<kwk::concepts::container Container>
 void init_chemicals(Container &u, Container &v, std::size_t d0, std::size_t d1)
@@ -74,26 +92,49 @@ void init_chemicals(Container &u, Container &v, std::size_t d0, std::size_t d1)
     }, region_v);
 }
 
+// Calls kernel(row_begin, row_end) on every band of rows of the region
+template<typename Kernel>
+void for_each_row_block(std::size_t d0, Kernel&& kernel)
+{
+    const std::size_t rows      = d0 - 2 * PADDING;
+    const std::size_t nb_blocks = (rows + ROW_BLOCK - 1) / ROW_BLOCK;
+
+    #pragma omp parallel for schedule(static)
+    for(std::size_t block = 0; block < nb_blocks; block++)
+    {
+        const std::size_t row_begin = block * ROW_BLOCK;
+        kernel(row_begin, std::min(row_begin + ROW_BLOCK, rows));
+    }
+}
+
+// Rows [row_begin, row_end) of the region, the input band holding 
+// their halo rows as well
 template<kwk::concepts::container Container>
-void process_kwk(Container const& iu, Container const& iv,
-                 Container      & ou, Container      & ov,
-                 std::size_t d0, std::size_t d1)
+void process_kwk_rows(Container const& iu, Container const& iv,
+                      Container      & ou, Container      & ov,
+                      std::size_t d1, std::size_t row_begin, std::size_t row_end)
 {
+    const std::size_t rows      = row_end - row_begin;
+
     const auto region_stride    = kwk::with_strides(d1, 1); 
-    const auto region_shape     = kwk::of_size(d0 - 2 * PADDING, d1 - 2 * PADDING);
+    const auto region_shape     = kwk::of_size(rows, d1 - 2 * PADDING);
+    const auto band_shape       = kwk::of_size(rows + 2 * PADDING, d1);
+
+    const auto iu_band  = kwk::view{ kwk::source = &iu(row_begin, 0), band_shape, region_stride };
+    const auto iv_band  = kwk::view{ kwk::source = &iv(row_begin, 0), band_shape, region_stride };
 
     const auto offset   = kumi::tuple{1_c, 1_c};
-    const auto tiled_u  = paving_tiles(iu, stencil_shape, offset);
-    const auto tiled_v  = paving_tiles(iv, stencil_shape, offset); 
+    const auto tiled_u  = paving_tiles(iu_band, stencil_shape, offset);
+    const auto tiled_v  = paving_tiles(iv_band, stencil_shape, offset); 
 
     // View for the output
-    auto ou_view = kwk::view{ kwk::source = &ou(PADDING,PADDING), region_shape, region_stride };
-    auto ov_view = kwk::view{ kwk::source = &ov(PADDING,PADDING), region_shape, region_stride };
+    auto ou_view = kwk::view{ kwk::source = &ou(PADDING + row_begin, PADDING), region_shape, region_stride };
+    auto ov_view = kwk::view{ kwk::source = &ov(PADDING + row_begin, PADDING), region_shape, region_stride };
    
     kwk::for_each([&]( real& out_u, real& out_v, auto const& tile_u, auto const& tile_v )
     {
-        const auto u = tile_u(0, 0, 1, 1);
-        const auto v = tile_v(0, 0, 1, 1);
+        const auto u = tile_u(0, 0, PADDING, PADDING);
+        const auto v = tile_v(0, 0, PADDING, PADDING);
         const auto uvv = u * v * v;
 
         auto full_u = 0.f;
@@ -115,25 +156,26 @@ void process_kwk(Container const& iu, Container const& iv,
 }
 
 template<kwk::concepts::container Container>
-void process_kwk_simd(Container const& iu, Container const& iv,
+void process_kwk(Container const& iu, Container const& iv,
                  Container      & ou, Container      & ov,
                  std::size_t d0, std::size_t d1)
 {
-    const auto region_stride    = kwk::with_strides(d1, wide_t::size()); 
-    const auto region_shape     = kwk::of_size(d0 - 2 * PADDING, d1 - 2 * PADDING);
-
-    const auto offset   = kumi::tuple{1_c, wide_t::size()};
-    const auto tiled_u  = paving_tiles(iu, stencil_shape, offset);
-    const auto tiled_v  = paving_tiles(iv, stencil_shape, offset); 
+    for_each_row_block(d0, [&](std::size_t row_begin, std::size_t row_end)
+    {
+        process_kwk_rows(iu, iv, ou, ov, d1, row_begin, row_end);
+    });
+}
 
-    // View for the output
-    auto ou_view = kwk::view{ kwk::source = &ou(PADDING,PADDING), region_shape, region_stride };
-    auto ov_view = kwk::view{ kwk::source = &ov(PADDING,PADDING), region_shape, region_stride };
-   
-    kwk::for_each([&]( real& out_u, real& out_v, auto const& tile_u, auto const& tile_v )
+// Stencil on the wide_t::size() cells following out_u/out_v, only the lanes
+// kept by ignore are read and written so that a partial vector never
+// touches the cells past the end of the row
+template<typename Ignore>
+auto simd_stencil(Ignore ignore)
+{
+    return [ignore]( real& out_u, real& out_v, auto const& tile_u, auto const& tile_v )
     {
-        const wide_t u = eve::load( &tile_u(0,0,1,1) );
-        const wide_t v = eve::load( &tile_v(0,0,1,1) );
+        const wide_t u = eve::load[ignore]( &tile_u(0,0,PADDING,PADDING) );
+        const wide_t v = eve::load[ignore]( &tile_v(0,0,PADDING,PADDING) );
         const wide_t uvv = u * v * v;
 
         wide_t full_u{ 0.f };
@@ -141,8 +183,8 @@ void process_kwk_simd(Container const& iu, Container const& iv,
 
         kwk::for_each([&](real const& uu, real const& vv, real const& weight)
         {
-            const wide_t uu_vector = eve::load(&uu);
-            const wide_t vv_vector = eve::load(&vv);
+            const wide_t uu_vector = eve::load[ignore](&uu);
+            const wide_t vv_vector = eve::load[ignore](&vv);
 
             full_u += weight * (uu_vector - u);
             full_v += weight * (vv_vector - v);
@@ -155,19 +197,274 @@ void process_kwk_simd(Container const& iu, Container const& iv,
         du = u + du * DT;
         dv = v + dv * DT;             
        
-        eve::store(du, &out_u);
-        eve::store(dv, &out_v);
+        eve::store[ignore](du, &out_u);
+        eve::store[ignore](dv, &out_v);
+    };
+}
 
-    }, ou_view, ov_view, tiled_u, tiled_v);
+// Columns [col, col + nb_wides * LANES + tail) of the rows [row_begin, row_end) 
+// of the region, by vectors of LANES cells. With a tail, nb_wides is 1 and 
+// only its first tail lanes are computed
+template<kwk::concepts::container Container, typename Ignore>
+void process_kwk_simd_block(Container const& iu, Container const& iv,
+                            Container      & ou, Container      & ov,
+                            std::size_t d1, std::size_t row_begin, std::size_t row_end,
+                            std::size_t col, std::size_t nb_cols, std::size_t nb_wides,
+                            Ignore ignore)
+{
+    const std::size_t rows      = row_end - row_begin;
+
+    const auto band_stride      = kwk::with_strides(d1, 1);
+    const auto band_shape       = kwk::of_size(rows + 2 * PADDING, nb_cols + 2 * PADDING);
+
+    // One output element per vector, LANES cells apart
+    const auto region_stride    = kwk::with_strides(d1, LANES); 
+    const auto region_shape     = kwk::of_size(rows, nb_wides);
+
+    const auto iu_band  = kwk::view{ kwk::source = &iu(row_begin, col), band_shape, band_stride };
+    const auto iv_band  = kwk::view{ kwk::source = &iv(row_begin, col), band_shape, band_stride };
+
+    const auto offset   = kumi::tuple{1_c, LANES};
+    const auto tiled_u  = paving_tiles(iu_band, stencil_shape, offset);
+    const auto tiled_v  = paving_tiles(iv_band, stencil_shape, offset); 
+
+    // View for the output
+    auto ou_view = kwk::view{ kwk::source = &ou(PADDING + row_begin, PADDING + col), region_shape, region_stride };
+    auto ov_view = kwk::view{ kwk::source = &ov(PADDING + row_begin, PADDING + col), region_shape, region_stride };
+   
+    kwk::for_each(simd_stencil(ignore), ou_view, ov_view, tiled_u, tiled_v);
+}
+
+// Full vectors first, then the columns left by a masked vector per row
+template<kwk::concepts::container Container>
+void process_kwk_simd_rows(Container const& iu, Container const& iv,
+                           Container      & ou, Container      & ov,
+                           std::size_t d1, std::size_t row_begin, std::size_t row_end)
+{
+    const std::size_t cols      = d1 - 2 * PADDING;
+    const std::size_t nb_wides  = cols / LANES;
+    const std::size_t tail      = cols % LANES;
+
+    if(nb_wides)
+    {
+        process_kwk_simd_block(iu, iv, ou, ov, d1, row_begin, row_end,
+                               0, nb_wides * LANES, nb_wides, eve::ignore_none);
+    }
+
+    if(tail)
+    {
+        process_kwk_simd_block(iu, iv, ou, ov, d1, row_begin, row_end,
+                               nb_wides * LANES, tail, 1, 
+                               eve::keep_first(static_cast<std::ptrdiff_t>(tail)));
+    }
+}
+
+template<kwk::concepts::container Container>
+void process_kwk_simd(Container const& iu, Container const& iv,
+                      Container      & ou, Container      & ov,
+                      std::size_t d0, std::size_t d1)
+{
+    for_each_row_block(d0, [&](std::size_t row_begin, std::size_t row_end)
+    {
+        process_kwk_simd_rows(iu, iv, ou, ov, d1, row_begin, row_end);
+    });
+}
+
+// Sum of the neighbour weights, the centre term of the stencil being -WEIGHT_SUM * c
+constexpr real WEIGHT_SUM = STENCIL.sum();
+
+// pairs[e] : sum of the two cells e columns away from the centre, pairs[0]
+// being the centre. Symmetric cells share their weight so they are added first
+using pair_sums_t = std::array<wide_t, PADDING + 1>;
+
+// A row of the sliding window : its centre vector and, for every vertical
+// distance d to the output row, the weighted sum of its cells. A row is
+// loaded once and used at all the distances it takes while the window moves
+struct window_row_t
+{
+    wide_t centre;
+    std::array<wide_t, PADDING + 1> at_distance;
+};
+
+// Zero weights generate no code
+template<std::size_t D, std::size_t E>
+inline void add_term(wide_t& sum, pair_sums_t const& pairs)
+{
+    constexpr real weight = STENCIL.weight(D, E);
+    if constexpr(weight != 0.f)
+        sum += weight * pairs[E];
+}
+
+template<std::size_t D>
+inline wide_t row_sum(pair_sums_t const& pairs)
+{
+    wide_t sum{ 0.f };
+    [&]<std::size_t... E>(std::index_sequence<E...>)
+    {
+        (add_term<D, E>(sum, pairs), ...);
+    }(std::make_index_sequence<PADDING + 1>{});
+
+    return sum;
+}
+
+// Horizontal neighbours come from unaligned loads one cell apart, they hit
+// the lines brought by the centre load
+template<typename Ignore>
+inline window_row_t load_window_row(real const* row, Ignore ignore)
+{
+    pair_sums_t pairs;
+    pairs[0] = eve::load[ignore](row);
+
+    [&]<std::size_t... E>(std::index_sequence<E...>)
+    {
+        ((pairs[E + 1] = eve::load[ignore](row - (E + 1)) + eve::load[ignore](row + (E + 1))), ...);
+    }(std::make_index_sequence<PADDING>{});
+
+    window_row_t window_row;
+    window_row.centre = pairs[0];
+
+    [&]<std::size_t... D>(std::index_sequence<D...>)
+    {
+        ((window_row.at_distance[D] = row_sum<D>(pairs)), ...);
+    }(std::make_index_sequence<PADDING + 1>{});
+
+    return window_row;
+}
+
+// Laplacian of the centre row of the window
+inline wide_t window_laplacian(std::array<window_row_t, STENCIL_SIZE> const& window)
+{
+    wide_t sum = window[PADDING].at_distance[0];
+    for(std::size_t d = 1; d <= PADDING; d++)
+        sum += window[PADDING - d].at_distance[d] + window[PADDING + d].at_distance[d];
+
+    return sum - WEIGHT_SUM * window[PADDING].centre;
+}
+
+// Streams a column of vectors down the rows (iu, iv) + d1 * [PADDING, PADDING + rows), 
+// every input row is loaded once and reused by all the outputs it touches
+template<typename Ignore>
+inline void sliding_column(real const* iu, real const* iv, real* ou, real* ov,
+                           std::size_t d1, std::size_t rows, Ignore ignore)
+{
+    std::array<window_row_t, STENCIL_SIZE> u_window;
+    std::array<window_row_t, STENCIL_SIZE> v_window;
+
+    for(std::size_t k = 0; k + 1 < STENCIL_SIZE; k++)
+    {
+        u_window[k + 1] = load_window_row(iu + k * d1, ignore);
+        v_window[k + 1] = load_window_row(iv + k * d1, ignore);
+    }
+
+    for(std::size_t i = 0; i < rows; i++)
+    {
+        for(std::size_t k = 0; k + 1 < STENCIL_SIZE; k++)
+        {
+            u_window[k] = u_window[k + 1];
+            v_window[k] = v_window[k + 1];
+        }
+        u_window[STENCIL_SIZE - 1] = load_window_row(iu + (i + STENCIL_SIZE - 1) * d1, ignore);
+        v_window[STENCIL_SIZE - 1] = load_window_row(iv + (i + STENCIL_SIZE - 1) * d1, ignore);
+
+        const wide_t u = u_window[PADDING].centre;
+        const wide_t v = v_window[PADDING].centre;
+        const wide_t uvv = u * v * v;
+
+        const wide_t full_u = window_laplacian(u_window);
+        const wide_t full_v = window_laplacian(v_window);
+
+        auto du = DIFFUSION_RATE_U * full_u - uvv + FEED_RATE * (1.0f - u);
+        auto dv = DIFFUSION_RATE_V * full_v + uvv - (FEED_RATE + KILL_RATE) * v;
+
+        eve::store[ignore](u + du * DT, ou + i * d1);
+        eve::store[ignore](v + dv * DT, ov + i * d1);
+    }
+}
+
+template<kwk::concepts::container Container>
+void process_kwk_sliding_rows(Container const& iu, Container const& iv,
+                              Container      & ou, Container      & ov,
+                              std::size_t d1, std::size_t row_begin, std::size_t row_end)
+{
+    const std::size_t rows      = row_end - row_begin;
+    const std::size_t cols      = d1 - 2 * PADDING;
+    const std::size_t nb_wides  = cols / LANES;
+    const std::size_t tail      = cols % LANES;
+
+    for(std::size_t w = 0; w < nb_wides; w++)
+    {
+        const std::size_t col = PADDING + w * LANES;
+        sliding_column(&iu(row_begin, col), &iv(row_begin, col),
+                       &ou(PADDING + row_begin, col), &ov(PADDING + row_begin, col),
+                       d1, rows, eve::ignore_none);
+    }
+
+    if(tail)
+    {
+        const std::size_t col = PADDING + nb_wides * LANES;
+        sliding_column(&iu(row_begin, col), &iv(row_begin, col),
+                       &ou(PADDING + row_begin, col), &ov(PADDING + row_begin, col),
+                       d1, rows, eve::keep_first(static_cast<std::ptrdiff_t>(tail)));
+    }
+}
+
+// Same interface as process_kwk_simd, STENCIL_SIZE loads per output vector
+// and member instead of STENCIL_SIZE^2
+template<kwk::concepts::container Container>
+void process_kwk_sliding(Container const& iu, Container const& iv,
+                         Container      & ou, Container      & ov,
+                         std::size_t d0, std::size_t d1)
+{
+    for_each_row_block(d0, [&](std::size_t row_begin, std::size_t row_end)
+    {
+        process_kwk_sliding_rows(iu, iv, ou, ov, d1, row_begin, row_end);
+    });
+}
+
+// One step of every kernel from the same state, the SIMD ones must not be
+// further than CHECK_TOLERANCE from the scalar reference
+template<kwk::concepts::container Container>
+bool check_simd_kernel(Container const& u, Container const& v, std::size_t d0, std::size_t d1)
+{
+    const auto shape = kwk::of_size(d0, d1);
+    const std::vector<real> zeros(d0*d1, 0.f);
+
+    auto u_ref  = kwk::table{ kwk::source = zeros, shape };
+    auto v_ref  = kwk::table{ kwk::source = zeros, shape };
+    auto u_simd = kwk::table{ kwk::source = zeros, shape };
+    auto v_simd = kwk::table{ kwk::source = zeros, shape };
+
+    process_kwk( u, v, u_ref, v_ref, d0, d1 );
+
+    auto difference = [&]()
+    {
+        real error = 0.f;
+        kwk::for_each([&](real const& a, real const& b, real const& c, real const& d)
+        {
+            error = std::max({ error, std::abs(a - b), std::abs(c - d) });
+        }, u_ref, u_simd, v_ref, v_simd);
+        return error;
+    };
+
+    process_kwk_simd( u, v, u_simd, v_simd, d0, d1 );
+    const real simd_error = difference();
+
+    process_kwk_sliding( u, v, u_simd, v_simd, d0, d1 );
+    const real sliding_error = difference();
+
+    std::cout << "Max difference to scalar : SIMD " << simd_error 
+              << ", sliding " << sliding_error << std::endl;
+    return (simd_error <= CHECK_TOLERANCE) && (sliding_error <= CHECK_TOLERANCE);
 }
 
 //
 int main(int argc, char *argv[])
 {
 
-    if(argc != 5)
+    if(argc != 5 && argc != 6)
     {
-        std::cerr << "Usage is " << argv[0] << " <rows> <columns> <images> <interactive> \n";
+        std::cerr << "Usage is " << argv[0] << " <rows> <columns> <images> <interactive> [check]\n"
+                  << "  interactive : 0 for a batch run, else the steps between two frames\n";
         exit(1);
     }
 
@@ -175,6 +472,7 @@ int main(int argc, char *argv[])
     std::size_t d1    { std::stoul(argv[2]) + 2 * PADDING };
     std::size_t steps { std::stoul(argv[3]) };
     std::size_t inter { std::stoul(argv[4]) };
+    std::size_t check { (argc == 6) ? std::stoul(argv[5]) : 0 };
 
     // Temporary work images
     std::vector<real> u1(d0*d1 , 0.f);
@@ -193,35 +491,88 @@ int main(int argc, char *argv[])
 
     if (!inter)
     {
+        const auto start = std::chrono::steady_clock::now();
+
         // Iterations;
         for (std::size_t step = 0; step < steps; ++step)
         { 
-            process_kwk( u1_kwk, v1_kwk, u2_kwk, v2_kwk, d0, d1 );
+            process_kwk_sliding( u1_kwk, v1_kwk, u2_kwk, v2_kwk, d0, d1 );
 
             u1_kwk.swap(u2_kwk);
             v1_kwk.swap(v2_kwk); 
         }
 
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << steps << " steps in " << std::fixed << std::setprecision(3) 
+                  << elapsed.count() << " s on " << omp_get_max_threads() << " threads\n"
+                  << std::defaultfloat;
+
         // Final product
         real product = kwk::inner_product(u1_kwk, v1_kwk, 0.f);
         std::cout << "Inner product : " << product << std::endl; 
+
+        if(check && !check_simd_kernel(u1_kwk, v1_kwk, d0, d1))
+            return 1;
     }
     else
     {
+        // The simulation runs on its own thread and publishes a frame every
+        // inter steps, this one (which owns the window) presents the newest
+        // frame at the display rate. Closing the window stops the simulation
         Renderer renderer(d0, d1);
+        triple_buffer<real> frames(d0 * d1);
+        std::atomic<bool> running{ true };
 
         init_chemicals(u1_kwk, v1_kwk, d0, d1);
 
-        // Iterations;
-        for (std::size_t step = 0; step < steps; ++step)
-        { 
-            process_kwk_simd( u1_kwk, v1_kwk, u2_kwk, v2_kwk, d0, d1 );
+        std::thread simulation([&]
+        {
+            // Iterations;
+            for (std::size_t step = 0; step < steps && running; ++step)
+            { 
+                process_kwk_sliding( u1_kwk, v1_kwk, u2_kwk, v2_kwk, d0, d1 );
+
+                u1_kwk.swap(u2_kwk);
+                v1_kwk.swap(v2_kwk);
+
+                if ((step + 1) % inter && step + 1 < steps)
+                    continue;
+
+                // The copy is split between the threads of the step, it would
+                // cost as much as the step on a single one
+                real const* v   = v1_kwk.get_data();
+                real* back      = frames.back().data();
+
+                #pragma omp parallel for schedule(static)
+                for (std::size_t i = 0; i < d0; ++i)
+                    std::copy_n(v + i * d1, d1, back + i * d1);
+
+                frames.publish();
+            }
+            running = false;
+        });
+
+        // The last frame is drawn again when the view moves between two frames
+        std::vector<real> const* shown = nullptr;
+        while (running)
+        {
+            if (!renderer.poll())
+                running = false;
 
-            u1_kwk.swap(u2_kwk);
-            v1_kwk.swap(v2_kwk);
+            auto frame = frames.acquire();
+            if (frame)
+                shown = frame;
 
-            renderer.render(d0, d1, v1_kwk);
+            if (shown && (frame || renderer.moved()))
+                renderer.render(d0, d1, shown->data());
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
+        simulation.join();
+
+        // Last state
+        if (auto frame = frames.acquire())
+            renderer.render(d0, d1, frame->data());
     }
     return 0;
 }
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <algorithm>
+
+// Isotropic stencil of radius R, applied as sum(w * (n - c)) over the
+// neighbours n of a cell c. The weight of the neighbour at (di, dj) only
+// depends on {|di|, |dj|} : weights[a][b] (a <= b) is the one of the
+// neighbours at distances (a, b) and (b, a), the centre has none.
+// Kernels expand it at compile time, zero weights generate no code and
+// neighbours sharing a weight are summed before the multiplication.
+template<typename T, std::size_t R>
+struct stencil_t
+{
+    static constexpr std::size_t radius = R;
+    static constexpr std::size_t size   = 2 * R + 1;
+
+    T weights[R + 1][R + 1];
+
+    constexpr T weight(std::size_t di, std::size_t dj) const
+    {
+        if(di == 0 && dj == 0)
+            return T{ 0 };
+
+        return weights[std::min(di, dj)][std::max(di, dj)];
+    }
+
+    // Distance to the centre of the row (or column) i of the dense table
+    static constexpr std::size_t distance(std::size_t i)
+    {
+        return (i < R) ? R - i : i - R;
+    }
+
+    // Sum of the neighbour weights, the centre term being -sum() * c
+    constexpr T sum() const
+    {
+        T total{ 0 };
+        for(std::size_t i = 0; i < size; i++)
+            for(std::size_t j = 0; j < size; j++)
+                total += weight(distance(i), distance(j));
+
+        return total;
+    }
+
+    // Row major (size x size) table of the weights, zero at the centre
+    constexpr std::array<T, size * size> dense() const
+    {
+        std::array<T, size * size> table{};
+        for(std::size_t i = 0; i < size; i++)
+            for(std::size_t j = 0; j < size; j++)
+                table[i * size + j] = weight(distance(i), distance(j));
+
+        return table;
+    }
+};
+
+/*
+    5 points            9 points
+    | 0 |  1 | 0 |      | 0.25 | 0.5 | 0.25 |
+    | 1 | -4 | 1 |      |  0.5 |  -3 | 0.5  |
+    | 0 |  1 | 0 |      | 0.25 | 0.5 | 0.25 |
+*/
+template<typename T>
+constexpr stencil_t<T, 1> five_points   { { { T(0), T(1)    },
+                                            { T(0), T(0)    } } };
+
+template<typename T>
+constexpr stencil_t<T, 1> nine_points   { { { T(0), T(0.5)  },
+                                            { T(0), T(0.25) } } };
+
+// Fourth order cross of radius 2 : 4/3 on the edges, -1/12 two cells away
+template<typename T>
+constexpr stencil_t<T, 2> cross_radius_2 { { { T(0), T(4.0 / 3.0), T(-1.0 / 12.0) },
+                                             { T(0), T(0)         , T(0)           },
+                                             { T(0), T(0)         , T(0)           } } };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <utility>
+
+// Newest-value exchange between one producer and one consumer : the
+// producer fills back() then publishes it, the consumer takes the newest
+// published buffer. Neither waits on the other for more than the swap of
+// two indices, buffers the consumer is too slow for are overwritten.
+template<typename T>
+class triple_buffer
+{
+public:
+    explicit triple_buffer(std::size_t size)
+        : buffers{ std::vector<T>(size), std::vector<T>(size), std::vector<T>(size) }
+    {}
+
+    // Only touched by the producer until the next publish
+    std::vector<T>& back() { return buffers[back_index]; }
+
+    void publish()
+    {
+        std::lock_guard lock(mutex);
+        std::swap(back_index, ready_index);
+        fresh = true;
+    }
+
+    // Newest buffer, nullptr when nothing was published since the last call.
+    // It is only touched by the consumer until the next acquire
+    std::vector<T> const* acquire()
+    {
+        std::lock_guard lock(mutex);
+        if (!fresh)
+            return nullptr;
+
+        std::swap(front_index, ready_index);
+        fresh = false;
+        return &buffers[front_index];
+    }
+
+private:
+    std::array<std::vector<T>, 3> buffers;
+    std::size_t back_index  = 0;
+    std::size_t ready_index = 1;
+    std::size_t front_index = 2;
+    bool fresh              = false;
+    std::mutex mutex;
+};
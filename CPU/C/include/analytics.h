@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "types.h"
+#include "simulation.h"
+
+typedef enum analytics_format_e
+{
+    // One line per record, header first
+    ANALYTICS_CSV   = 0,
+    // One JSON object per line
+    ANALYTICS_JSON  = 1
+} analytics_format_t;
+
+typedef struct field_stats_s
+{
+    f64 min;
+    f64 max;
+    f64 mean;
+    f64 variance;
+} field_stats_t;
+
+// Summary of a state, over the cells of the grid (halos and padding rows
+// of the layout excluded)
+typedef struct analytics_s
+{
+    field_stats_t u;
+    field_stats_t v;
+    // Sum of u + v over the grid
+    f64 mass;
+    // Root mean square change of u and v over the last step, negative
+    // when it is not known
+    f64 residual;
+} analytics_t;
+
+// One parallel pass over chem, and previous when not NULL : the state one
+// step before, for the residual
+extern analytics_t analyze(chemicals_t const *chem, chemicals_t const *previous);
+
+// Records streamed to a file, "-" being stdout. The format is JSON for a
+// .json file name, CSV otherwise. Every record is flushed, so a run can be
+// followed while it goes
+typedef struct analytics_log_s
+{
+    FILE *fp;
+    analytics_format_t format;
+    u64 nb_records;
+} analytics_log_t;
+
+extern void analytics_open(analytics_log_t *log, char const *file_name);
+extern void analytics_write(analytics_log_t *log, u64 step, analytics_t const *stats);
+extern void analytics_close(analytics_log_t *log);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "types.h"
+#include "simulation.h"
+#include "snapshot.h"
+
+// Hands frames to a dedicated I/O thread through a bounded FIFO of
+// preallocated buffers : the step loop only pays for a copy of the state,
+// and only waits when all the buffers are still waiting to be written.
+typedef struct async_writer_s
+{
+    snapshot_t *snap;
+
+    u64 nb_buffers;
+    chemicals_t *buffers;
+    u64 *steps;
+
+    // Buffers [head, head + count) (modulo nb_buffers) are queued,
+    // the one at head being written while count > 0
+    u64 head;
+    u64 count;
+    u8 closing;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    pthread_t       thread;
+
+    // Statistics to size the queue
+    u64 nb_frames;
+    u64 max_depth;
+    u64 depth_sum;
+    u64 nb_stalls;
+    f64 stall_time;
+    f64 write_time;
+} async_writer_t;
+
+extern void async_writer_init(async_writer_t *writer, snapshot_t *snap,
+                              u64 num_rows, u64 num_cols, u64 nb_buffers);
+extern void async_writer_push(async_writer_t *writer, chemicals_t const *chem, u64 step);
+extern void async_writer_close(async_writer_t *writer);
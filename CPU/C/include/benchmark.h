@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+#include "simulation.h"
+
+// Times nb_steps steps of the stencil (by blocks of temporal_block fused
+// steps) after nb_warmup ones, then reports the step time distribution and
+// the achieved throughput against a roofline measured on the machine.
+// With rates, the same number of single steps with per-cell rates are
+// timed as well, to measure the cost of the two extra planes.
+// A JSON line with all the figures is printed on stdout.
+extern void benchmark_run(u64 num_rows, u64 num_cols, u64 nb_warmup, u64 nb_steps,
+                          u64 temporal_block, rates_t const *rates);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "types.h"
+#include "simulation.h"
+
+// Checkpoints are single frame raw snapshot files (see snapshot.h) of the
+// state and of the number of steps done. The step loop copies the state in
+// a buffer, a dedicated thread writes it in <file_name>.tmp then renames it
+// over file_name : the last checkpoint on the disk is always complete.
+typedef struct checkpoint_s
+{
+    char const *file_name;
+    char *tmp_name;
+
+    chemicals_t buffer;
+    u64 step;
+
+    // Set while the buffer waits for or is being written
+    u8 pending;
+    u8 closing;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  done;
+    pthread_t       thread;
+
+    u64 nb_checkpoints;
+    f64 stall_time;
+    f64 write_time;
+} checkpoint_t;
+
+extern void checkpoint_init(checkpoint_t *checkpoint, char const *file_name,
+                            u64 num_rows, u64 num_cols);
+extern void checkpoint_push(checkpoint_t *checkpoint, chemicals_t const *chem, u64 step);
+extern void checkpoint_close(checkpoint_t *checkpoint);
+
+// State of the last frame of a snapshot file, checkpoint or output,
+// in the layout of new_chemicals
+extern chemicals_t checkpoint_load(char const *file_name, u64 *step);
@@ -8,8 +8,45 @@ typedef struct args_s
     u64 num_cols;
     u64 output_frequency;
     u64 steps;
+    u64 temporal_block;
+    u64 nb_domains;
+    u64 queue_size;
+    u64 checkpoint_frequency;
+    // Measured steps of the benchmark mode, 0 to run the simulation
+    u64 benchmark;
+    u64 warmup;
+    // Model parameters, from constants.h, a config file (-C) or the options
+    f64 feed_rate;
+    f64 kill_rate;
+    f64 diffusion_u;
+    f64 diffusion_v;
+    f64 delta_t;
     u8 interactive;
+    u8 huge_pages;
+    u8 compression;
+    f64 error_bound;
     char *file_name;
+    char *checkpoint_file;
+    char *restart_file;
+    // Per-cell rates (-G), the feed rate going from feed_range[0] to 
+    // feed_range[1] along the rows and the kill rate along the columns
+    u8 rate_gradient;
+    f64 feed_range[2];
+    f64 kill_range[2];
+    // Members of the ensemble mode, NULL to run a single simulation
+    char *ensemble_file;
+    // Images or video of v in the batch mode (-x), NULL for none, encoded
+    // by export_threads threads
+    char *export_file;
+    u64 export_threads;
+    // Statistics of the state every analytics_frequency steps (every 
+    // output when 0) in analytics_file (-a), NULL for none
+    char *analytics_file;
+    u64 analytics_frequency;
+    // The run stops once the largest change of u and v of a step stayed
+    // under steady_threshold (-y) for steady_steps steps, 0 to never stop
+    f64 steady_threshold;
+    u64 steady_steps;
 } args_t;
 
 extern void parse_arguments(int argc, char *argv[argc+1], args_t *args);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+#include "simulation.h"
+
+// Cells of the grid shown by an image
+typedef struct viewport_s
+{
+    u64 row;
+    u64 col;
+    u64 num_rows;
+    u64 num_cols;
+} viewport_t;
+
+// Buffers of the box filter, sized once for a grid, an image width and a
+// number of threads, so that a frame allocates nothing
+typedef struct colorize_buffers_s
+{
+    u64 width;
+    u64 nb_threads;
+    // First row of every pixel column, width + 1 entries
+    u64 *row_starts;
+    // Where the column sums of every row of the grid are
+    u64 *row_offsets;
+    // Column sums of the rows of the layout, one block per thread
+    u64 sums_size;
+    real *sums;
+} colorize_buffers_t;
+
+extern colorize_buffers_t new_colorize_buffers(chemicals_t const *like, u64 width, u64 nb_threads);
+extern void free_colorize_buffers(colorize_buffers_t *buffers);
+
+// Colour of v in the view (the whole grid when NULL) of a grid in the
+// vertical-lane layout, as width x height RGBA8888 pixels of the colormap :
+// the grid rows are the image columns and the grid columns its rows, the
+// image row y starts pitch bytes after the row y - 1. When the view is
+// bigger than the image, a pixel is the mean of the cells it covers (box
+// filter), when it is smaller, a cell spans several pixels. Runs on the
+// OpenMP team of the calling thread, up to buffers->nb_threads threads
+extern void colorize(chemicals_t const *chem, viewport_t const *view, 
+                     colorize_buffers_t const *buffers, void *pixels, u64 pitch,
+                     u64 width, u64 height);
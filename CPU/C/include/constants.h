@@ -11,12 +11,34 @@
 #define STENCIL_ORDER       3ULL
 #define STENCIL_OFFSET      1ULL
 
-const real STENCIL_WEIGHTS[STENCIL_ORDER][STENCIL_ORDER] = 
-{
-    {0.25, 0.5, 0.25},
-    { 0.5, 0.0, 0.5 },
-    {0.25, 0.5, 0.25}
-};
+// Isotropic 3x3 stencil applied as sum(w * (n - c)) : the 4 edges share
+// STENCIL_EDGE_WEIGHT and the 4 corners STENCIL_CORNER_WEIGHT, so kernels
+// compute edge * sum(edges) + corner * sum(corners) - center * c, without
+// the corner terms for the 5 points stencil. Halos are one cell wide so the
+// radius is fixed to STENCIL_OFFSET. Selected at build time (make STENCIL=5)
+//
+//  5 points    | 0 |  1 | 0 |      9 points    | 0.25 | 0.5 | 0.25 |
+//              | 1 | -4 | 1 |                  |  0.5 |  -3 | 0.5  |
+//              | 0 |  1 | 0 |                  | 0.25 | 0.5 | 0.25 |
+#ifndef STENCIL_POINTS
+    #define STENCIL_POINTS  9
+#endif
+
+#if STENCIL_POINTS == 9
+    #define STENCIL_EDGE_WEIGHT     REAL_TYPE(0.5)
+    #define STENCIL_CORNER_WEIGHT   REAL_TYPE(0.25)
+    // Per member : 3 + 3 adds, 3 products, 2 adds
+    #define STENCIL_FLOPS           11
+#elif STENCIL_POINTS == 5
+    #define STENCIL_EDGE_WEIGHT     REAL_TYPE(1.0)
+    #define STENCIL_CORNER_WEIGHT   REAL_TYPE(0.0)
+    // Per member : 3 adds, 2 products, 1 sub
+    #define STENCIL_FLOPS           6
+#else
+    #error "STENCIL_POINTS must be 5 or 9"
+#endif
+
+#define STENCIL_CENTER_WEIGHT   (REAL_TYPE(4.0) * (STENCIL_EDGE_WEIGHT + STENCIL_CORNER_WEIGHT))
 
 #define PADDING_OFFSET_X    1ULL
 #define PADDING_OFFSET_Y    1ULL
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include "simulation.h"
+
+// The grid is split by blocks of columns, each subdomain being a full
+// chemicals_t (same lanes, same rows) owned by one OpenMP thread group.
+// Splitting along the columns keeps the vertical-lane layout untouched, the
+// halos to exchange are the first and last center columns of a subdomain.
+//
+// Thread groups are meant to be pinned one per NUMA node, e.g. :
+//  OMP_PLACES=sockets OMP_PROC_BIND=spread,close OMP_NUM_THREADS=<cores>
+typedef struct domains_s
+{
+    u64 nb_domains;
+    u64 num_rows;
+    u64 num_cols;
+    u64 team_size;
+
+    // Column d of the grid starts the subdomain d, nb_domains + 1 entries
+    u64 *col_start;
+
+    chemicals_t *in;
+    chemicals_t *out;
+
+    // Shared-memory ring of halo columns,
+    // [domain][slot][side][member][column_size]
+    u64 column_size;
+    real *ring;
+    u64 step;
+} domains_t;
+
+extern domains_t new_domains(u64 x, u64 y, u64 nb_domains);
+extern void free_domains(domains_t *domains);
+
+// Returns the largest change of u and v of all the steps
+extern real domains_run(domains_t *domains, u64 nb_steps);
+extern void domains_gather(domains_t const *domains, chemicals_t *global);
+extern void domains_scatter(domains_t *domains, chemicals_t const *global);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "types.h"
+#include "simulation.h"
+
+// Independent simulations of the same (num_rows, num_cols) size, one per
+// SIMD lane : a batch is a chemicals_t whose lane k holds a whole grid of
+// num_rows center rows instead of a strip of a larger one, so that a single
+// vector step advances simd_width members. Batches are handed to the OpenMP
+// threads, each member has its own feed and kill rates and initial seed,
+// the diffusion rates and the time step being the ones of use_params.
+//
+// Members are read from a text file, one "feed_rate kill_rate [seed]" per
+// line, '#' starting a comment. Seed 0 (the default) is the square of
+// new_chemicals, any other value places it at a pseudo-random position.
+typedef struct ensemble_s
+{
+    u64 nb_members;
+    u64 nb_batches;
+    u64 simd_width;
+    u64 num_rows;
+    u64 num_cols;
+    u64 step;
+
+    // nb_batches * simd_width entries, the lanes past nb_members stay at zero
+    real *feed_rates;
+    real *kill_rates;
+    u64 *seeds;
+
+    chemicals_t *in;
+    chemicals_t *out;
+} ensemble_t;
+
+extern ensemble_t new_ensemble(char const *file_name, u64 x, u64 y);
+extern void free_ensemble(ensemble_t *ensemble);
+
+extern void ensemble_run(ensemble_t *ensemble, u64 nb_steps);
+
+// Summary of every member instead of its fields, as CSV
+extern void ensemble_write_header(FILE *fp);
+extern void ensemble_write_stats(ensemble_t const *ensemble, FILE *fp);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "simulation.h"
+
+typedef enum export_format_e
+{
+    // One binary PPM (P6) image per frame
+    EXPORT_PPM  = 0,
+    // One RGB PNG image per frame, deflated with zlib
+    EXPORT_PNG  = 1,
+    // A single YUV4MPEG2 4:4:4 stream, readable by ffmpeg and most players
+    EXPORT_Y4M  = 2
+} export_format_t;
+
+// Headless export of v through the colormap of the interactive mode, with
+// the same orientation (grid rows are the image columns). The format is
+// given by the extension of the file name : images are written in
+// <stem>_<step>.<ppm|png>, a .y4m file receives all the frames.
+//
+// The step loop copies v in a ring of preallocated slots, a pool of worker
+// threads colour-maps and encodes them, each with its own buffers, and
+// writes them (in order for the Y4M stream). The loop only waits when all
+// the slots are still being encoded.
+typedef struct exporter_s
+{
+    export_format_t format;
+    char *stem;
+    char const *extension;
+    FILE *stream;
+
+    u64 width;
+    u64 height;
+
+    // Frame s (counted from 0) goes in the slot s % nb_slots. Frames
+    // [next_encode, next_push) wait for a worker, frames below next_write
+    // are written, a slot is free again once its frame is written
+    u64 nb_slots;
+    chemicals_t *slots;
+    u64 *steps;
+    u8 *busy;
+    u64 next_push;
+    u64 next_encode;
+    u64 next_write;
+    u8 closing;
+
+    u64 nb_workers;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t  queued;
+    pthread_cond_t  freed;
+    pthread_cond_t  written;
+
+    u64 nb_stalls;
+    f64 stall_time;
+    f64 encode_time;
+} exporter_t;
+
+// Frames of the states laid out as like, encoded by nb_workers threads
+extern void exporter_init(exporter_t *exporter, char const *file_name,
+                          chemicals_t const *like, u64 nb_workers);
+extern void exporter_push(exporter_t *exporter, chemicals_t const *chem, u64 step);
+extern void exporter_close(exporter_t *exporter);
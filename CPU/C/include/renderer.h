@@ -5,17 +5,31 @@
 #include "types.h"
 #include "simulation.h"
 #include "cli_handler.h"
+#include "colorize.h"
 
 typedef struct SDL_config_s
 {
     u32 dim_x;
     u32 dim_y;
+    // The window shows the grid divided by 2^zoom along both axes, from
+    // the cell (view_row, view_col)
+    u64 grid_rows;
+    u64 grid_cols;
+    u32 zoom;
+    f64 view_row;
+    f64 view_col;
     SDL_Window      *window;
     SDL_Renderer    *renderer;
     SDL_Texture     *texture;
+    colorize_buffers_t buffers;
 } SDL_config_t;
 
-extern SDL_config_t render_init(args_t *args);
+// like is a grid of the simulation, for the buffers of the box filter
+extern SDL_config_t render_init(args_t const *args, chemicals_t const *like);
 extern void render_cleanup(SDL_config_t *config);
 
+// Zoom with the mouse wheel around the cursor, pan by dragging with the
+// left button, r goes back to the whole grid. Returns 1 when the view moved
+extern u8 render_handle_event(SDL_config_t *config, SDL_Event const *event);
+
 extern void render_gray_scott(SDL_config_t config, chemicals_t const* chemicals);
@@ -12,18 +12,69 @@ typedef struct chemicals_s
     u64 x_size;
     u64 y_size;
     u64 nb_members; 
+    u64 simd_width;
+    u64 num_rows;
     real *restrict u;
     real *restrict v;  
 } chemicals_t;
 
+// Feed rate and F + k of every cell, in the layout of a chemicals_t of
+// the same size
+typedef struct rates_s
+{
+    u64 x_size;
+    u64 y_size;
+    u64 simd_width;
+    u64 num_rows;
+    real *restrict feed;
+    real *restrict feed_kill;
+} rates_t;
+
+// Parameters of the model, chosen at run time
+typedef struct params_s
+{
+    real feed_rate;
+    real kill_rate;
+    real diffusion_u;
+    real diffusion_v;
+    real delta_t;
+} params_t;
+
+extern u64 detect_simd_width(void);
+extern void use_huge_pages(u8 enable);
+
+// The values of constants.h
+extern params_t default_params(void);
+// Parameters of the following steps, checked then turned into the 
+// coefficients of the kernels
+extern void use_params(params_t const *params);
+
 extern chemicals_t new_chemicals(u64 x, u64 y);
+extern chemicals_t new_chemicals_block(u64 x, u64 y, u64 col_start, u64 nb_cols);
 extern chemicals_t zeros_chemicals(u64 x, u64 y);
 extern void free_chemicals(chemicals_t *chemical);
 
-extern void simulation_step(chemicals_t const* in, chemicals_t* out);
+// From (x, y) row major maps of the feed and kill rates
+extern rates_t new_rates(u64 x, u64 y, real const *feed_rates, real const *kill_rates);
+extern void free_rates(rates_t *rates);
+
+// Returns the largest change |out - in| of u and v over the grid, reduced
+// while the step is computed
+extern real simulation_step(chemicals_t const* in, chemicals_t* out);
+// Same as simulation_step with the feed and kill rates of every cell
+extern real simulation_step_rates(chemicals_t const* in, chemicals_t* out,
+                                  rates_t const *rates);
+// nb_steps steps at once, no change is reported
+extern void simulation_steps_fused(chemicals_t const* in, chemicals_t* out, u64 nb_steps);
+// Independent grids of x_size - 2 rows, one per lane, with their own feed
+// and kill rates (simd_width values each), see ensemble.h
+extern void simulation_step_lanes(chemicals_t const* in, chemicals_t* out,
+                                  real const *feed_rates, real const *kill_rates);
 extern void swap_chemicals(chemicals_t *ptr_1, chemicals_t *ptr_2);
+extern void copy_chemicals(chemicals_t *dst, chemicals_t const *src);
 
 extern void write_data(FILE *fp, chemicals_t const *chemical);
 extern chemicals_t read_data(FILE *fp);
 
 extern chemicals_t to_scalar_layout(chemicals_t const *in);
+extern chemicals_t from_scalar_layout(chemicals_t const *in);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "types.h"
+#include "simulation.h"
+
+// Snapshot files hold frames of the scalar (num_rows x num_cols) fields,
+// without halos nor SIMD padding :
+//
+//  | header | frame 0 | frame 1 | ... | index | footer |
+//
+// A frame is a frame header, a table of nb_chunks chunk entries then the
+// chunks, starting on a SNAPSHOT_ALIGNMENT boundary. A chunk holds
+// chunk_rows rows of one member, chunks are stored member by member.
+// Raw chunks are stored back to back so a raw frame is the u plane followed
+// by the v plane. The index lists the offsets of the frames and is written
+// on close, a file without footer can still be read by walking the frames.
+
+#define SNAPSHOT_MAGIC      0x544F435359415247ULL // "GRAYSCOT"
+#define SNAPSHOT_VERSION    1U
+#define SNAPSHOT_ALIGNMENT  64ULL
+
+typedef enum snapshot_codec_e
+{
+    // Plain values, can be mapped without copy
+    SNAPSHOT_RAW        = 0,
+    // Lossless, bytes of the values are shuffled then deflated
+    SNAPSHOT_SHUFFLE    = 1,
+    // Lossy, values are quantized with a step of 2 * error_bound, then
+    // shuffled and deflated. The header holds the bound given to
+    // snapshot_create minus a rounding margin, so that the absolute error
+    // of the decoded reals stays under the given bound for values in [-1, 1]
+    SNAPSHOT_QUANTIZE   = 2
+} snapshot_codec_t;
+
+typedef struct snapshot_header_s
+{
+    u64 magic;
+    u32 version;
+    u32 real_size;
+    u64 num_rows;
+    u64 num_cols;
+    u64 nb_members;
+    u64 chunk_rows;
+    u32 codec;
+    u32 reserved;
+    f64 error_bound;
+} snapshot_header_t;
+
+typedef struct snapshot_frame_s
+{
+    u64 step;
+    u64 nb_chunks;
+    // Size of the whole frame, headers and padding included
+    u64 frame_bytes;
+    // Offset of the first chunk from the start of the frame
+    u64 data_offset;
+} snapshot_frame_t;
+
+typedef struct snapshot_chunk_s
+{
+    // From the first chunk of the frame
+    u64 offset;
+    u64 bytes;
+} snapshot_chunk_t;
+
+typedef struct snapshot_footer_s
+{
+    u64 index_offset;
+    u64 nb_frames;
+    u64 magic;
+} snapshot_footer_t;
+
+typedef struct snapshot_s
+{
+    FILE *fp;
+    snapshot_header_t header;
+    u64 nb_chunks;
+    u64 file_offset;
+
+    u64 nb_frames;
+    u64 max_frames;
+    u64 *frame_offsets;
+
+    // One output buffer per chunk so that they are compressed in parallel
+    u64 chunk_capacity;
+    u8 *chunk_data;
+    snapshot_chunk_t *chunks;
+} snapshot_t;
+
+// Read side : the file is mapped, raw frames are handed out as views of the
+// mapping, compressed ones are decoded in a buffer owned by the reader
+typedef struct snapshot_reader_s
+{
+    u8 *map;
+    u64 map_bytes;
+    snapshot_header_t header;
+
+    u64 nb_frames;
+    u64 *frame_offsets;
+
+    // Holds the last compressed frame decoded
+    real *decoded;
+} snapshot_reader_t;
+
+extern snapshot_t snapshot_create(char const *file_name, u64 num_rows, u64 num_cols,
+                                  snapshot_codec_t codec, f64 error_bound);
+extern void snapshot_write(snapshot_t *snap, chemicals_t const *chem, u64 step);
+extern void snapshot_close(snapshot_t *snap);
+
+extern snapshot_reader_t snapshot_open(char const *file_name);
+extern chemicals_t snapshot_frame(snapshot_reader_t *reader, u64 index, u64 *step);
+extern void snapshot_reader_close(snapshot_reader_t *reader);
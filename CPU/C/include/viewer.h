@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "types.h"
+#include "simulation.h"
+#include "cli_handler.h"
+#include "renderer.h"
+
+// Interactive mode : the simulation runs at full speed on its own thread
+// and publishes v every output_frequency steps in a triple buffer, the
+// calling thread (which owns the SDL window, as SDL wants) presents the
+// newest published frame at the display rate. Neither side waits for the
+// other but for the swap of two slot indices, frames the display is too
+// slow for are skipped. Closing the window stops the simulation.
+typedef struct viewer_s
+{
+    // v planes in the layout of the simulation, u being NULL. The
+    // simulation fills back, publish swaps it with ready, the display
+    // swaps front with ready when fresh is set
+    chemicals_t slots[3];
+    u64 steps[3];
+    u64 back;
+    u64 ready;
+    u64 front;
+    u8 fresh;
+
+    u8 done;
+    u8 stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  published;
+    pthread_t       thread;
+
+    // Simulation state and its parameters
+    args_t const *args;
+    chemicals_t *uv_in;
+    chemicals_t *uv_out;
+    rates_t const *rates;
+    u64 first_step;
+    u64 last_step;
+
+    u64 nb_published;
+    u64 nb_presented;
+} viewer_t;
+
+// Steps (uv_in, uv_out) from first_step to args->steps while displaying
+// them, uv_in holds the last state on return
+extern void viewer_run(SDL_config_t config, args_t const *args, chemicals_t *uv_in,
+                       chemicals_t *uv_out, rates_t const *rates, u64 first_step);
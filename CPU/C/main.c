@@ -1,8 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <omp.h>
 
 #include "simulation.h"
+#include "domain.h"
+#include "snapshot.h"
+#include "async_writer.h"
+#include "checkpoint.h"
+#include "exporter.h"
+#include "analytics.h"
+#include "ensemble.h"
+#include "benchmark.h"
 #include "cli_handler.h"
 #include "renderer.h"
+#include "viewer.h"
 #include "logs.h"
 
 // Where shall that be ??
@@ -23,14 +35,15 @@ void tmp_print(chemicals_t *chem)
 
 void tmp_print_simd(chemicals_t *chem)
 {
-    real (*u)[chem->y_size][4] = make_3D_span(real, , chem->u, chem->y_size, 4);
+    real (*u)[chem->y_size][chem->simd_width] 
+        = make_3D_span(real, , chem->u, chem->y_size, chem->simd_width);
 
     for(u64 i = 0; i < chem->x_size; i++)
     {
         for(u64 j = 0; j < chem->y_size; j++)
         {
             printf("[");
-            for(u64 k = 0; k < 4; k++)
+            for(u64 k = 0; k < chem->simd_width; k++)
             {
                 //printf("|%lld%lld", i, j);
                 printf("%3.2f ", u[i][j][k]);
@@ -41,65 +54,335 @@ void tmp_print_simd(chemicals_t *chem)
     }
 }
 
+// Phase map of the model : the feed rate grows along the rows and the kill
+// rate along the columns, linearly between the bounds of -G
+static rates_t gradient_rates(args_t const *args)
+{
+    const u64 x = args->num_rows;
+    const u64 y = args->num_cols;
+
+    real *feed = (real *)malloc(2 * x * y * sizeof(real));
+    if(!feed)
+    {
+        gs_error_print("Could not allocate the rate maps of %lld x %lld cells", x, y);
+    }
+    real *kill = feed + x * y;
+
+    const f64 feed_step = (x > 1) ? (args->feed_range[1] - args->feed_range[0]) / (f64)(x - 1) : 0.0;
+    const f64 kill_step = (y > 1) ? (args->kill_range[1] - args->kill_range[0]) / (f64)(y - 1) : 0.0;
+
+    for(u64 i = 0; i < x; i++)
+    {
+        for(u64 j = 0; j < y; j++)
+        {
+            feed[i * y + j] = (real)(args->feed_range[0] + feed_step * (f64)i);
+            kill[i * y + j] = (real)(args->kill_range[0] + kill_step * (f64)j);
+        }
+    }
+
+    rates_t rates = new_rates(x, y, feed, kill);
+    free(feed);
+    return rates;
+}
+
 int main(int argc, char **argv)
 {
     args_t args;
     parse_arguments(argc, argv, &args);
+    use_huge_pages(args.huge_pages);
+
+    const params_t params = { (real)args.feed_rate, (real)args.kill_rate, 
+                              (real)args.diffusion_u, (real)args.diffusion_v, 
+                              (real)args.delta_t };
+    use_params(&params);
+
+    if(args.benchmark)
+    {
+        rates_t rates;
+        if(args.rate_gradient)
+            rates = gradient_rates(&args);
+
+        benchmark_run(args.num_rows, args.num_cols, args.warmup, args.benchmark,
+                      args.temporal_block, args.rate_gradient ? &rates : NULL);
+
+        if(args.rate_gradient)
+            free_rates(&rates);
+        return 0;
+    }
+
+    // Statistics of every member every output_frequency steps, on stdout
+    if(args.ensemble_file)
+    {
+        ensemble_t ensemble = new_ensemble(args.ensemble_file, args.num_rows, args.num_cols);
+        ensemble_write_header(stdout);
+
+        const f64 start = omp_get_wtime();
+        for(u64 i = 0; i < args.steps;)
+        {
+            u64 nb_steps = args.output_frequency - i % args.output_frequency;
+            if(nb_steps > args.steps - i)   nb_steps = args.steps - i;
+
+            ensemble_run(&ensemble, nb_steps);
+            i += nb_steps;
+
+            if((i % args.output_frequency == 0) || (i == args.steps))
+                ensemble_write_stats(&ensemble, stdout);
+        }
+
+        const f64 elapsed = omp_get_wtime() - start;
+        gs_info_print("%lld steps of %lld members in %.3lf s, %.3e cell updates/s",
+                      args.steps, ensemble.nb_members, elapsed,
+                      (f64)(args.steps * ensemble.nb_members * args.num_rows * args.num_cols) 
+                      / elapsed);
+
+        free_ensemble(&ensemble);
+        return 0;
+    }
         
     // In debug print a logo and the args of the sim or do it with -v maybe
 
     chemicals_t uv_in;   
     chemicals_t uv_out; 
+
+    // The grid size of a restart is the one of the checkpoint
+    u64 first_step = 0;
+    chemicals_t restart;
+    if(args.restart_file)
+    {
+        restart         = checkpoint_load(args.restart_file, &first_step);
+        args.num_rows   = restart.num_rows;
+        args.num_cols   = restart.y_size - 2;
+        if(first_step >= args.steps)
+        {
+            gs_warn_print("Step %lld already reached, nothing to do", args.steps);
+        }
+    }
+
+    // Per-cell rates are only stepped one step at a time on a single domain
+    rates_t rates;
+    if(args.rate_gradient)
+    {
+        if(args.nb_domains > 1)
+        {
+            gs_error_print("Per-cell rates need a single domain, %lld requested", args.nb_domains);
+        }
+        if(args.temporal_block > 1)
+        {
+            gs_warn_print("Steps are not fused with per-cell rates, %lld requested",
+                          args.temporal_block);
+            args.temporal_block = 1;
+        }
+        rates = gradient_rates(&args);
+    }
+
+    // Fused steps give no change per step to watch
+    if(args.steady_threshold > 0.0 && args.temporal_block > 1 && args.nb_domains == 1)
+    {
+        gs_warn_print("Steps are not fused to detect the steady state, %lld requested",
+                      args.temporal_block);
+        args.temporal_block = 1;
+    }
      
     if(!args.interactive)  
     {
-        FILE *fp = fopen(args.file_name, "wb");
-        if(!fp)
-            gs_error_print("Couldn't open file : %s", args.file_name);
+        snapshot_t snap = snapshot_create(args.file_name, args.num_rows, args.num_cols,
+                                          (snapshot_codec_t)args.compression, args.error_bound);
         
-        uv_in   = new_chemicals(args.num_rows, args.num_cols);
-        uv_out  = zeros_chemicals(args.num_rows, args.num_cols);
+        // With subdomains, uv_in only receives the gathered frames
+        domains_t domains;
+        if(args.nb_domains > 1)
+        {
+            domains     = new_domains(args.num_rows, args.num_cols, args.nb_domains);
+            uv_in       = zeros_chemicals(args.num_rows, args.num_cols);
+            uv_out.u    = NULL;
+
+            // The state a step before an analysis, for the residual
+            if(args.analytics_file)
+                uv_out  = zeros_chemicals(args.num_rows, args.num_cols);
+
+            if(args.restart_file)
+            {
+                domains_scatter(&domains, &restart);
+                free_chemicals(&restart);
+            }
+        }
+        else
+        {
+            uv_in   = args.restart_file ? restart : new_chemicals(args.num_rows, args.num_cols);
+            uv_out  = zeros_chemicals(args.num_rows, args.num_cols);
+        }
        
         gs_debug_print("Num rows : %lld; num cols : %lld", args.num_rows, args.num_cols);
         gs_debug_print("X size : %lld; Y size : %lld", uv_in.x_size, uv_in.y_size);
         
-        for(u64 i = 0; i < args.steps; i++)
-        {
-            simulation_step(&uv_in, &uv_out);
-            swap_chemicals(&uv_in, &uv_out);
+        // Frames are written by a dedicated thread unless the queue is empty
+        async_writer_t writer;
+        if(args.queue_size)
+            async_writer_init(&writer, &snap, args.num_rows, args.num_cols, args.queue_size);
 
-            if(i % args.output_frequency == 0)
-                write_data(fp, &uv_in);
-        }
+        checkpoint_t checkpoint;
+        if(args.checkpoint_frequency)
+            checkpoint_init(&checkpoint, args.checkpoint_file, args.num_rows, args.num_cols);
 
-        fclose(fp);
-    }
-    else
-    { 
-        SDL_config_t sdl_conf = render_init(&args);
- 
-        uv_in   = new_chemicals(args.num_rows, args.num_cols);
-        uv_out  = zeros_chemicals(args.num_rows, args.num_cols);
-        
-        chemicals_t tmp; 
-        
-        for(u64 i = 0; i < args.steps; i++)
+        exporter_t exporter;
+        if(args.export_file)
+            exporter_init(&exporter, args.export_file, &uv_in, args.export_threads);
+
+        analytics_log_t analytics = {0};
+        if(args.analytics_file)
+            analytics_open(&analytics, args.analytics_file);
+
+        // Steps in a row whose changes stayed under steady_threshold
+        u64 quiet_steps = 0;
+        u64 i           = first_step;
+
+        const f64 start = omp_get_wtime();
+
+        // Steps are fused by blocks of at most temporal_block, a block never
+        // goes past the next output, checkpoint nor analysis. The last step
+        // before an analysis is a block of its own, for the residual
+        while(i < args.steps)
         {
-            simulation_step(&uv_in, &uv_out);
-            swap_chemicals(&uv_in, &uv_out);
+            const u64 next_output = ((i + args.output_frequency - 1) 
+                                  / args.output_frequency) * args.output_frequency;
+            
+            u64 nb_steps = next_output - i + 1;
+            if(nb_steps > args.steps - i)       nb_steps = args.steps - i;
 
-            if(i % args.output_frequency == 0)
+            if(args.checkpoint_frequency)
             {
-                tmp = to_scalar_layout(&uv_in);
-                render_gray_scott(sdl_conf, &tmp);
+                const u64 next_checkpoint = (i / args.checkpoint_frequency + 1) 
+                                          * args.checkpoint_frequency;
+                if(nb_steps > next_checkpoint - i)  nb_steps = next_checkpoint - i;
             }
 
+            if(args.analytics_file && args.analytics_frequency)
+            {
+                const u64 next_analysis = (i / args.analytics_frequency + 1) 
+                                        * args.analytics_frequency;
+                if(nb_steps > next_analysis - i)    nb_steps = next_analysis - i;
+            }
+
+            if((args.nb_domains == 1) && (nb_steps > args.temporal_block))
+                nb_steps = args.temporal_block;
+
+            // Subdomains report one change per block, kept within the steady window
+            if((args.steady_threshold > 0.0) && (nb_steps > args.steady_steps))
+                nb_steps = args.steady_steps;
+
+            const u64 end               = i + nb_steps;
+            const u8 ends_at_analysis   = args.analytics_file && (args.analytics_frequency 
+                                        ? (end % args.analytics_frequency == 0)
+                                        : ((end - 1) % args.output_frequency == 0));
+            if(ends_at_analysis && (nb_steps > 1))
+                nb_steps--;
+
+            // Subdomains keep the state before the step of an analysis
+            const u8 has_previous = (nb_steps == 1) && ((args.nb_domains == 1) || ends_at_analysis);
+            if((args.nb_domains > 1) && has_previous)
+                domains_gather(&domains, &uv_out);
+
+            // Largest change of u and v of the block, unknown for fused steps
+            real max_delta = REAL_TYPE(0.0);
+            if(args.nb_domains > 1)
+            {
+                max_delta = domains_run(&domains, nb_steps);
+            }
+            else
+            {
+                if(args.rate_gradient)
+                    max_delta = simulation_step_rates(&uv_in, &uv_out, &rates);
+                else if(nb_steps > 1)
+                    simulation_steps_fused(&uv_in, &uv_out, nb_steps);
+                else
+                    max_delta = simulation_step(&uv_in, &uv_out);
+                swap_chemicals(&uv_in, &uv_out);
+            }
+
+            i += nb_steps;
+
+            // A block is quiet only if all its steps are
+            u8 is_steady = 0;
+            if(args.steady_threshold > 0.0)
+            {
+                quiet_steps = ((f64)max_delta < args.steady_threshold) ? quiet_steps + nb_steps : 0;
+                is_steady   = (quiet_steps >= args.steady_steps);
+            }
+
+            // The steady state is written as a last output
+            const u8 is_output      = ((i - 1) % args.output_frequency == 0) || is_steady;
+            const u8 is_checkpoint  = args.checkpoint_frequency 
+                                   && (i % args.checkpoint_frequency == 0);
+            const u8 is_analysis    = args.analytics_file && (is_steady || (args.analytics_frequency 
+                                   ? (i % args.analytics_frequency == 0) : is_output));
+
+            // Subdomains are gathered once for all the uses of a step
+            if((args.nb_domains > 1) && (is_output || is_checkpoint || is_analysis))
+                domains_gather(&domains, &uv_in);
+
+            if(is_output)
+            {
+                if(args.queue_size)
+                    async_writer_push(&writer, &uv_in, i);
+                else
+                    snapshot_write(&snap, &uv_in, i);
+
+                if(args.export_file)
+                    exporter_push(&exporter, &uv_in, i);
+            }
+
+            if(is_checkpoint)
+                checkpoint_push(&checkpoint, &uv_in, i);
+
+            // uv_out holds the state a step before, unless the analysis comes
+            // from the steady state at the end of a block of subdomains
+            if(is_analysis)
+            {
+                const analytics_t stats = analyze(&uv_in, has_previous ? &uv_out : NULL);
+                analytics_write(&analytics, i, &stats);
+            }
+
+            if(is_steady)
+            {
+                gs_info_print("Steady state at step %lld : changes under %g for %lld steps",
+                              i, args.steady_threshold, quiet_steps);
+                break;
+            }
         }
 
-        free_chemicals(&tmp);
+        gs_info_print("%lld steps in %.3lf s", i - first_step, omp_get_wtime() - start);
+
+        if(args.analytics_file)
+            analytics_close(&analytics);
+
+        if(args.export_file)
+            exporter_close(&exporter);
+
+        if(args.checkpoint_frequency)
+            checkpoint_close(&checkpoint);
+
+        if(args.queue_size)
+            async_writer_close(&writer);
+
+        if(args.nb_domains > 1)
+            free_domains(&domains);
+        snapshot_close(&snap);
+    }
+    else
+    { 
+        uv_in   = args.restart_file ? restart : new_chemicals(args.num_rows, args.num_cols);
+        uv_out  = zeros_chemicals(args.num_rows, args.num_cols);
+
+        SDL_config_t sdl_conf = render_init(&args, &uv_in);
+        
+        viewer_run(sdl_conf, &args, &uv_in, &uv_out, 
+                   args.rate_gradient ? &rates : NULL, first_step);
         render_cleanup(&sdl_conf);
     }
 
+    if(args.rate_gradient)
+        free_rates(&rates);
+
     free_chemicals(&uv_in);
     free_chemicals(&uv_out);
 
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Compares the single OpenMP team run with one subdomain per NUMA node.
+# Usage : script/bench_domains.sh [rows] [cols] [steps]
+# Build first with `make`, run from the CPU/C directory.
+
+BIN=./build/gray_scott
+ROWS=${1:-8192}
+COLS=${2:-8192}
+STEPS=${3:-200}
+
+SOCKETS=$(lscpu -p=SOCKET | grep -v '^#' | sort -u | wc -l)
+NODES=$(lscpu -p=NODE | grep -v '^#' | sort -u | wc -l)
+THREADS=$(nproc)
+DOMAINS=${DOMAINS:-$NODES}
+
+echo "$SOCKETS socket(s), $NODES NUMA node(s), $THREADS threads, $ROWS x $COLS, $STEPS steps"
+
+# Only the frame of the first step is written, to /dev/null
+OPTS="-r $ROWS -c $COLS -s $STEPS -f $STEPS -o /dev/null"
+
+echo "Single team :"
+OMP_NUM_THREADS=$THREADS OMP_PLACES=cores OMP_PROC_BIND=close \
+    $BIN $OPTS
+
+echo "$DOMAINS subdomain(s) :"
+OMP_NUM_THREADS=$THREADS OMP_PLACES=cores OMP_PROC_BIND=spread,close \
+    $BIN $OPTS -d $DOMAINS
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+
+#include "analytics.h"
+#include "logs.h"
+
+// Columns summed in the precision of the simulation, a whole lane vector
+// at a time, before their sums go to the f64 totals
+#define ANALYTICS_BLOCK_Y   64ULL
+
+// Widest SIMD layout, 16 floats of AVX-512
+#define ANALYTICS_MAX_LANES 16ULL
+
+analytics_t analyze(chemicals_t const *chem, chemicals_t const *previous)
+{
+    const u64 simd_width        = chem->simd_width;
+    const u64 num_center_rows   = chem->x_size - 2;
+    const u64 num_rows          = chem->num_rows;
+    const u64 num_cols          = chem->y_size - 2;
+    const f64 nb_cells          = (f64)(num_rows * num_cols);
+
+    assert(simd_width <= ANALYTICS_MAX_LANES);
+
+    const real (*restrict u_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->u, chem->y_size, simd_width);
+
+    const real (*restrict v_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+    // Same layout, only read when previous is given
+    const real (*restrict prev_u_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, previous ? previous->u : chem->u, chem->y_size, simd_width);
+
+    const real (*restrict prev_v_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, previous ? previous->v : chem->v, chem->y_size, simd_width);
+
+    f64 sum_u = 0.0, sum_v = 0.0, sq_u = 0.0, sq_v = 0.0, sq_delta = 0.0;
+    f64 min_u = DBL_MAX, min_v = DBL_MAX, max_u = -DBL_MAX, max_v = -DBL_MAX;
+
+    #pragma omp parallel for schedule(static) reduction(+:sum_u, sum_v, sq_u, sq_v, sq_delta) \
+                                              reduction(min:min_u, min_v) reduction(max:max_u, max_v)
+    for(u64 i = 1; i <= num_center_rows; i++)
+    {
+        f64 row_sums[5][ANALYTICS_MAX_LANES] = {0};
+        real row_min_u[ANALYTICS_MAX_LANES], row_max_u[ANALYTICS_MAX_LANES];
+        real row_min_v[ANALYTICS_MAX_LANES], row_max_v[ANALYTICS_MAX_LANES];
+
+        for(u64 k = 0; k < simd_width; k++)
+        {
+            row_min_u[k] = row_max_u[k] = u_span[i][1][k];
+            row_min_v[k] = row_max_v[k] = v_span[i][1][k];
+        }
+
+        for(u64 j0 = 1; j0 <= num_cols; j0 += ANALYTICS_BLOCK_Y)
+        {
+            const u64 j1 = (j0 + ANALYTICS_BLOCK_Y <= num_cols + 1) ? j0 + ANALYTICS_BLOCK_Y : num_cols + 1;
+            real block_sums[5][ANALYTICS_MAX_LANES] = {0};
+
+            for(u64 j = j0; j < j1; j++)
+            {
+                #pragma omp simd
+                for(u64 k = 0; k < simd_width; k++)
+                {
+                    const real u = u_span[i][j][k];
+                    const real v = v_span[i][j][k];
+                    block_sums[0][k] += u;
+                    block_sums[1][k] += v;
+                    block_sums[2][k] += u * u;
+                    block_sums[3][k] += v * v;
+                    row_min_u[k] = (u < row_min_u[k]) ? u : row_min_u[k];
+                    row_max_u[k] = (u > row_max_u[k]) ? u : row_max_u[k];
+                    row_min_v[k] = (v < row_min_v[k]) ? v : row_min_v[k];
+                    row_max_v[k] = (v > row_max_v[k]) ? v : row_max_v[k];
+                }
+            }
+
+            if(previous)
+            {
+                for(u64 j = j0; j < j1; j++)
+                {
+                    #pragma omp simd
+                    for(u64 k = 0; k < simd_width; k++)
+                    {
+                        const real du = u_span[i][j][k] - prev_u_span[i][j][k];
+                        const real dv = v_span[i][j][k] - prev_v_span[i][j][k];
+                        block_sums[4][k] += du * du + dv * dv;
+                    }
+                }
+            }
+
+            for(u64 s = 0; s < 5; s++)
+            {
+                #pragma omp simd
+                for(u64 k = 0; k < simd_width; k++)
+                    row_sums[s][k] += (f64)block_sums[s][k];
+            }
+        }
+
+        // Lanes holding a row of the grid, the padding rows are at the end
+        // of the last lanes
+        u64 nb_lanes = (num_rows - (i - 1) + num_center_rows - 1) / num_center_rows;
+        nb_lanes     = (nb_lanes < simd_width) ? nb_lanes : simd_width;
+
+        for(u64 k = 0; k < nb_lanes; k++)
+        {
+            sum_u       += row_sums[0][k];
+            sum_v       += row_sums[1][k];
+            sq_u        += row_sums[2][k];
+            sq_v        += row_sums[3][k];
+            sq_delta    += row_sums[4][k];
+            min_u = ((f64)row_min_u[k] < min_u) ? (f64)row_min_u[k] : min_u;
+            max_u = ((f64)row_max_u[k] > max_u) ? (f64)row_max_u[k] : max_u;
+            min_v = ((f64)row_min_v[k] < min_v) ? (f64)row_min_v[k] : min_v;
+            max_v = ((f64)row_max_v[k] > max_v) ? (f64)row_max_v[k] : max_v;
+        }
+    }
+
+    analytics_t stats;
+    stats.u.min         = min_u;
+    stats.u.max         = max_u;
+    stats.u.mean        = sum_u / nb_cells;
+    stats.u.variance    = fmax(sq_u / nb_cells - stats.u.mean * stats.u.mean, 0.0);
+    stats.v.min         = min_v;
+    stats.v.max         = max_v;
+    stats.v.mean        = sum_v / nb_cells;
+    stats.v.variance    = fmax(sq_v / nb_cells - stats.v.mean * stats.v.mean, 0.0);
+    stats.mass          = sum_u + sum_v;
+    stats.residual      = previous ? sqrt(sq_delta / (2.0 * nb_cells)) : -1.0;
+
+    return stats;
+}
+
+void analytics_open(analytics_log_t *log, char const *file_name)
+{
+    char const *dot = strrchr(file_name, '.');
+    log->format     = (dot && !strcmp(dot, ".json")) ? ANALYTICS_JSON : ANALYTICS_CSV;
+    log->nb_records = 0;
+
+    log->fp = strcmp(file_name, "-") ? fopen(file_name, "w") : stdout;
+    if(!log->fp)
+    {
+        gs_error_print("Could not open %s to write the analytics", file_name);
+    }
+
+    if(log->format == ANALYTICS_CSV)
+    {
+        fprintf(log->fp, "step,min_u,max_u,mean_u,var_u,min_v,max_v,mean_v,var_v,mass,residual\n");
+        fflush(log->fp);
+    }
+}
+
+void analytics_write(analytics_log_t *log, u64 step, analytics_t const *stats)
+{
+    if(log->format == ANALYTICS_CSV)
+    {
+        fprintf(log->fp, "%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.12g,",
+                step, stats->u.min, stats->u.max, stats->u.mean, stats->u.variance,
+                stats->v.min, stats->v.max, stats->v.mean, stats->v.variance, stats->mass);
+
+        // Left empty when unknown
+        if(stats->residual >= 0.0)
+            fprintf(log->fp, "%.9g", stats->residual);
+        fprintf(log->fp, "\n");
+    }
+    else
+    {
+        fprintf(log->fp, "{\"step\":%llu,"
+                "\"u\":{\"min\":%.9g,\"max\":%.9g,\"mean\":%.9g,\"variance\":%.9g},"
+                "\"v\":{\"min\":%.9g,\"max\":%.9g,\"mean\":%.9g,\"variance\":%.9g},"
+                "\"mass\":%.12g,\"residual\":",
+                step, stats->u.min, stats->u.max, stats->u.mean, stats->u.variance,
+                stats->v.min, stats->v.max, stats->v.mean, stats->v.variance, stats->mass);
+
+        if(stats->residual >= 0.0)
+            fprintf(log->fp, "%.9g}\n", stats->residual);
+        else
+            fprintf(log->fp, "null}\n");
+    }
+
+    fflush(log->fp);
+    log->nb_records++;
+}
+
+void analytics_close(analytics_log_t *log)
+{
+    gs_info_print("Analytics : %lld records", log->nb_records);
+
+    if(log->fp != stdout)
+        fclose(log->fp);
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include <omp.h>
+
+#include "async_writer.h"
+#include "logs.h"
+
+// Threads encoding a frame, the others are left to the simulation
+#define WRITER_THREADS  2
+
+static void *writer_loop(void *arg)
+{
+    async_writer_t *writer = (async_writer_t *)arg;
+
+    // The number of threads only applies to the parallel regions of this thread
+    omp_set_num_threads(WRITER_THREADS);
+
+    pthread_mutex_lock(&writer->lock);
+    for(;;)
+    {
+        while(!writer->count && !writer->closing)
+            pthread_cond_wait(&writer->not_empty, &writer->lock);
+
+        if(!writer->count)
+            break;
+
+        const u64 slot = writer->head;
+        pthread_mutex_unlock(&writer->lock);
+
+        // The slot stays counted while it is written, so it can't be reused
+        const f64 start = omp_get_wtime();
+        snapshot_write(writer->snap, &writer->buffers[slot], writer->steps[slot]);
+        const f64 elapsed = omp_get_wtime() - start;
+
+        pthread_mutex_lock(&writer->lock);
+        writer->write_time += elapsed;
+        writer->head = (writer->head + 1) % writer->nb_buffers;
+        writer->count--;
+        pthread_cond_signal(&writer->not_full);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+void async_writer_init(async_writer_t *writer, snapshot_t *snap,
+                       u64 num_rows, u64 num_cols, u64 nb_buffers)
+{
+    assert(nb_buffers > 0);
+
+    writer->snap        = snap;
+    writer->nb_buffers  = nb_buffers;
+    writer->head        = 0;
+    writer->count       = 0;
+    writer->closing     = 0;
+
+    writer->nb_frames   = 0;
+    writer->max_depth   = 0;
+    writer->depth_sum   = 0;
+    writer->nb_stalls   = 0;
+    writer->stall_time  = 0.0;
+    writer->write_time  = 0.0;
+
+    writer->buffers = (chemicals_t *)malloc(nb_buffers * sizeof(chemicals_t));
+    writer->steps   = (u64 *)malloc(nb_buffers * sizeof(u64));
+    if(!writer->buffers || !writer->steps)
+    {
+        gs_error_print("Could not allocate %lld output buffers", nb_buffers);
+    }
+
+    for(u64 b = 0; b < nb_buffers; b++)
+        writer->buffers[b] = zeros_chemicals(num_rows, num_cols);
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->not_empty, NULL);
+    pthread_cond_init(&writer->not_full, NULL);
+
+    if(pthread_create(&writer->thread, NULL, writer_loop, writer))
+    {
+        gs_error_print("Could not start the writer thread for %lld buffers", nb_buffers);
+    }
+}
+
+void async_writer_push(async_writer_t *writer, chemicals_t const *chem, u64 step)
+{
+    pthread_mutex_lock(&writer->lock);
+
+    if(writer->count == writer->nb_buffers)
+    {
+        const f64 start = omp_get_wtime();
+        while(writer->count == writer->nb_buffers)
+            pthread_cond_wait(&writer->not_full, &writer->lock);
+
+        writer->stall_time += omp_get_wtime() - start;
+        writer->nb_stalls++;
+    }
+
+    const u64 slot = (writer->head + writer->count) % writer->nb_buffers;
+    pthread_mutex_unlock(&writer->lock);
+
+    // The slot is neither queued nor being written, no need to hold the lock
+    copy_chemicals(&writer->buffers[slot], chem);
+    writer->steps[slot] = step;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->count++;
+    writer->nb_frames++;
+    writer->depth_sum += writer->count;
+    if(writer->count > writer->max_depth)
+        writer->max_depth = writer->count;
+
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Drains the queue, then reports how the buffers were used
+void async_writer_close(async_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = 1;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+
+    if(writer->nb_frames)
+    {
+        gs_info_print("Writer : %lld frames, queue depth mean %.2lf max %lld / %lld",
+                      writer->nb_frames, (f64)writer->depth_sum / (f64)writer->nb_frames,
+                      writer->max_depth, writer->nb_buffers);
+        gs_info_print("Writer : %lld stalls for %.3lf s, %.3lf s per frame written",
+                      writer->nb_stalls, writer->stall_time,
+                      writer->write_time / (f64)writer->nb_frames);
+    }
+
+    pthread_cond_destroy(&writer->not_full);
+    pthread_cond_destroy(&writer->not_empty);
+    pthread_mutex_destroy(&writer->lock);
+
+    for(u64 b = 0; b < writer->nb_buffers; b++)
+        free_chemicals(&writer->buffers[b]);
+
+    free(writer->buffers);
+    free(writer->steps);
+}
@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <omp.h>
+
+#include "benchmark.h"
+#include "constants.h"
+#include "simulation.h"
+#include "logs.h"
+
+// Operations of STENCIL_OPERATION for one cell, F + k being precomputed :
+//  - diffusion, per member : STENCIL_FLOPS
+//  - reaction : u * v * v (2), F * (1 - u) (2), -(F + K) * v (1)
+//  - update, per member : D * full -/+ uvv (3), u + du * dt (2)
+#define FLOPS_PER_CELL      (2 * STENCIL_FLOPS + 5 + 2 * 5)
+
+// Compulsory traffic of a step, u and v are read and written once, the
+// neighbours coming from the caches (STREAM convention, no write allocate)
+#define BYTES_PER_CELL      (4 * sizeof(real))
+// Plus the feed and F + k maps with per-cell rates
+#define RATES_BYTES_PER_CELL (6 * sizeof(real))
+
+// Independent accumulators per thread for the peak flops kernel, enough to
+// cover the FMA latency of two pipes with the widest vectors
+#define PEAK_LANES          128ULL
+#define PEAK_ITERATIONS     (1ULL << 20)
+
+#define STREAM_SIZE         (1ULL << 24)
+#define NB_REPEATS          5
+
+// Keeps the peak flops kernel from being optimized out
+static volatile real peak_sink;
+
+static int compare_f64(void const *a, void const *b)
+{
+    const f64 x = *(f64 const *)a;
+    const f64 y = *(f64 const *)b;
+    return (x > y) - (x < y);
+}
+
+// Best of NB_REPEATS STREAM triads, in GB/s
+static f64 measure_bandwidth(void)
+{
+    real *a = (real *)malloc(STREAM_SIZE * sizeof(real));
+    real *b = (real *)malloc(STREAM_SIZE * sizeof(real));
+    real *c = (real *)malloc(STREAM_SIZE * sizeof(real));
+    if(!a || !b || !c)
+    {
+        gs_error_print("Could not allocate %lld values for the bandwidth test", 3 * STREAM_SIZE);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(u64 i = 0; i < STREAM_SIZE; i++)
+    {
+        a[i] = REAL_TYPE(0.0);
+        b[i] = REAL_TYPE(1.0);
+        c[i] = REAL_TYPE(2.0);
+    }
+
+    f64 best = 1e30;
+    for(int r = 0; r < NB_REPEATS; r++)
+    {
+        const f64 start = omp_get_wtime();
+
+        #pragma omp parallel for simd schedule(static)
+        for(u64 i = 0; i < STREAM_SIZE; i++)
+            a[i] = b[i] + REAL_TYPE(3.0) * c[i];
+
+        const f64 elapsed = omp_get_wtime() - start;
+        if(elapsed < best) best = elapsed;
+    }
+
+    free(a);
+    free(b);
+    free(c);
+
+    return (f64)(3 * STREAM_SIZE * sizeof(real)) / best * 1e-9;
+}
+
+// Best of NB_REPEATS runs of independent multiply-adds, in GFLOP/s
+static f64 measure_peak_gflops(void)
+{
+    f64 best = 1e30;
+    real sink = REAL_TYPE(0.0);
+
+    for(int r = 0; r < NB_REPEATS; r++)
+    {
+        const f64 start = omp_get_wtime();
+
+        #pragma omp parallel reduction(+:sink)
+        {
+            real acc[PEAK_LANES];
+            for(u64 l = 0; l < PEAK_LANES; l++)
+                acc[l] = (real)l;
+
+            for(u64 it = 0; it < PEAK_ITERATIONS; it++)
+            {
+                #pragma omp simd
+                for(u64 l = 0; l < PEAK_LANES; l++)
+                    acc[l] = acc[l] * REAL_TYPE(0.999999) + REAL_TYPE(0.000001);
+            }
+
+            for(u64 l = 0; l < PEAK_LANES; l++)
+                sink += acc[l];
+        }
+
+        const f64 elapsed = omp_get_wtime() - start;
+        if(elapsed < best) best = elapsed;
+    }
+
+    peak_sink = sink;
+
+    const f64 flops = 2.0 * (f64)(PEAK_LANES * PEAK_ITERATIONS) * (f64)omp_get_max_threads();
+    return flops / best * 1e-9;
+}
+
+typedef struct timings_s
+{
+    f64 mean;
+    f64 median;
+    f64 p99;
+    f64 min;
+} timings_t;
+
+// Runs nb_warmup steps then times nb_blocks blocks of temporal_block steps, 
+// with the kernel of per-cell rates when rates is given (steps not fused)
+static timings_t time_steps(u64 num_rows, u64 num_cols, u64 nb_warmup, u64 nb_blocks,
+                            u64 temporal_block, rates_t const *rates, f64 *times)
+{
+    chemicals_t uv_in  = new_chemicals(num_rows, num_cols);
+    chemicals_t uv_out = zeros_chemicals(num_rows, num_cols);
+
+    for(u64 s = 0; s < nb_warmup; s++)
+    {
+        if(rates)
+            simulation_step_rates(&uv_in, &uv_out, rates);
+        else
+            simulation_step(&uv_in, &uv_out);
+        swap_chemicals(&uv_in, &uv_out);
+    }
+
+    // Blocks of fused steps are timed as a whole, then counted per step
+    f64 total = 0.0;
+    for(u64 b = 0; b < nb_blocks; b++)
+    {
+        const f64 start = omp_get_wtime();
+
+        if(rates)
+            simulation_step_rates(&uv_in, &uv_out, rates);
+        else if(temporal_block > 1)
+            simulation_steps_fused(&uv_in, &uv_out, temporal_block);
+        else
+            simulation_step(&uv_in, &uv_out);
+
+        times[b] = (omp_get_wtime() - start) / (f64)temporal_block;
+        total   += times[b] * (f64)temporal_block;
+        swap_chemicals(&uv_in, &uv_out);
+    }
+
+    qsort(times, nb_blocks, sizeof(f64), compare_f64);
+
+    timings_t timings;
+    timings.mean        = total / (f64)(nb_blocks * temporal_block);
+    timings.median      = (nb_blocks % 2) ? times[nb_blocks / 2]
+                        : 0.5 * (times[nb_blocks / 2 - 1] + times[nb_blocks / 2]);
+    timings.p99         = times[(99 * nb_blocks + 99) / 100 - 1];
+    timings.min         = times[0];
+
+    free_chemicals(&uv_in);
+    free_chemicals(&uv_out);
+    return timings;
+}
+
+void benchmark_run(u64 num_rows, u64 num_cols, u64 nb_warmup, u64 nb_steps,
+                   u64 temporal_block, rates_t const *rates)
+{
+    if(!temporal_block)
+        temporal_block = 1;
+
+    const u64 nb_blocks = (nb_steps + temporal_block - 1) / temporal_block;
+    nb_steps = nb_blocks * temporal_block;
+
+    f64 *times = (f64 *)malloc(nb_steps * sizeof(f64));
+    if(!times)
+    {
+        gs_error_print("Could not allocate the timings of %lld steps", nb_steps);
+    }
+
+    const timings_t timings = time_steps(num_rows, num_cols, nb_warmup, nb_blocks,
+                                         temporal_block, NULL, times);
+
+    const f64 mean      = timings.mean;
+    const f64 cells     = (f64)(num_rows * num_cols);
+    const f64 updates   = cells / mean;
+    const f64 gbytes    = updates * (f64)BYTES_PER_CELL * 1e-9;
+    const f64 gflops    = updates * (f64)FLOPS_PER_CELL * 1e-9;
+    const f64 intensity = (f64)FLOPS_PER_CELL / (f64)BYTES_PER_CELL;
+
+    const f64 peak_gbytes   = measure_bandwidth();
+    const f64 peak_gflops   = measure_peak_gflops();
+    const f64 roof          = (intensity * peak_gbytes < peak_gflops) ?
+                              intensity * peak_gbytes : peak_gflops;
+
+    gs_info_print("%lld x %lld, %lld lanes, %d threads, %lld warmup + %lld steps (blocks of %lld)",
+                  num_rows, num_cols, detect_simd_width(), omp_get_max_threads(),
+                  nb_warmup, nb_steps, temporal_block);
+    gs_info_print("Step time : mean %.3e s, median %.3e s, p99 %.3e s, min %.3e s",
+                  mean, timings.median, timings.p99, timings.min);
+    gs_info_print("%.3e cell updates/s, %.2lf GB/s, %.2lf GFLOP/s",
+                  updates, gbytes, gflops);
+    gs_info_print("Roofline : %.2lf GB/s, %.2lf GFLOP/s, %.2lf flop/B -> %.2lf GFLOP/s (%.1lf %%)",
+                  peak_gbytes, peak_gflops, intensity, roof, 100.0 * gflops / roof);
+
+    fprintf(stdout, "{\"engine\":\"c\",\"rows\":%llu,\"cols\":%llu,\"simd_width\":%llu,"
+                    "\"threads\":%d,\"real_bytes\":%zu,\"temporal_block\":%llu,"
+                    "\"warmup\":%llu,\"steps\":%llu,"
+                    "\"mean_s\":%.6e,\"median_s\":%.6e,\"p99_s\":%.6e,\"min_s\":%.6e,"
+                    "\"cell_updates_per_s\":%.6e,\"gbytes_per_s\":%.4f,\"gflops\":%.4f,"
+                    "\"peak_gbytes_per_s\":%.4f,\"peak_gflops\":%.4f,"
+                    "\"roofline_gflops\":%.4f,\"roofline_fraction\":%.4f",
+            num_rows, num_cols, detect_simd_width(), omp_get_max_threads(), sizeof(real),
+            temporal_block, nb_warmup, nb_steps, mean, timings.median, timings.p99, 
+            timings.min, updates, gbytes, gflops, peak_gbytes, peak_gflops, roof, 
+            gflops / roof);
+
+    // Same number of single steps with per-cell rates, the slowdown being
+    // the price of the two extra planes
+    if(rates)
+    {
+        const timings_t map = time_steps(num_rows, num_cols, nb_warmup, nb_steps, 1, 
+                                         rates, times);
+
+        const f64 map_updates   = cells / map.mean;
+        const f64 map_gbytes    = map_updates * (f64)RATES_BYTES_PER_CELL * 1e-9;
+        const f64 map_roof      = (f64)RATES_BYTES_PER_CELL / (f64)BYTES_PER_CELL;
+
+        gs_info_print("Per-cell rates : mean %.3e s, median %.3e s, %.3e cell updates/s, %.2lf GB/s",
+                      map.mean, map.median, map_updates, map_gbytes);
+        gs_info_print("Per-cell rates : %.2lfx the step time, %.2lfx when bandwidth bound",
+                      map.mean / mean, map_roof);
+
+        fprintf(stdout, ",\"rates_mean_s\":%.6e,\"rates_median_s\":%.6e,"
+                        "\"rates_cell_updates_per_s\":%.6e,\"rates_gbytes_per_s\":%.4f,"
+                        "\"rates_slowdown\":%.4f",
+                map.mean, map.median, map_updates, map_gbytes, map.mean / mean);
+    }
+    fprintf(stdout, "}\n");
+
+    free(times);
+}
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "logs.h"
+
+static void write_checkpoint(checkpoint_t *checkpoint)
+{
+    snapshot_t snap = snapshot_create(checkpoint->tmp_name, checkpoint->buffer.num_rows,
+                                      checkpoint->buffer.y_size - 2, SNAPSHOT_RAW, 0.0);
+    snapshot_write(&snap, &checkpoint->buffer, checkpoint->step);
+    snapshot_close(&snap);
+
+    if(rename(checkpoint->tmp_name, checkpoint->file_name))
+    {
+        gs_warn_print("Could not rename %s to %s, checkpoint of step %lld lost",
+                      checkpoint->tmp_name, checkpoint->file_name, checkpoint->step);
+    }
+}
+
+static void *checkpoint_loop(void *arg)
+{
+    checkpoint_t *checkpoint = (checkpoint_t *)arg;
+
+    // A raw checkpoint is bound by the disk, one thread copies it while the
+    // others keep stepping
+    omp_set_num_threads(1);
+
+    pthread_mutex_lock(&checkpoint->lock);
+    for(;;)
+    {
+        while(!checkpoint->pending && !checkpoint->closing)
+            pthread_cond_wait(&checkpoint->not_empty, &checkpoint->lock);
+
+        if(!checkpoint->pending)
+            break;
+
+        pthread_mutex_unlock(&checkpoint->lock);
+
+        const f64 start = omp_get_wtime();
+        write_checkpoint(checkpoint);
+        const f64 elapsed = omp_get_wtime() - start;
+
+        pthread_mutex_lock(&checkpoint->lock);
+        checkpoint->write_time += elapsed;
+        checkpoint->pending = 0;
+        pthread_cond_signal(&checkpoint->done);
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+
+    return NULL;
+}
+
+void checkpoint_init(checkpoint_t *checkpoint, char const *file_name,
+                     u64 num_rows, u64 num_cols)
+{
+    checkpoint->file_name       = file_name;
+    checkpoint->step            = 0;
+    checkpoint->pending         = 0;
+    checkpoint->closing         = 0;
+    checkpoint->nb_checkpoints  = 0;
+    checkpoint->stall_time      = 0.0;
+    checkpoint->write_time      = 0.0;
+
+    const u64 name_size = strlen(file_name) + sizeof(".tmp");
+    checkpoint->tmp_name = (char *)malloc(name_size);
+    if(!checkpoint->tmp_name)
+    {
+        gs_error_print("Could not allocate the name of the checkpoint %s", file_name);
+    }
+    snprintf(checkpoint->tmp_name, name_size, "%s.tmp", file_name);
+
+    checkpoint->buffer = zeros_chemicals(num_rows, num_cols);
+
+    pthread_mutex_init(&checkpoint->lock, NULL);
+    pthread_cond_init(&checkpoint->not_empty, NULL);
+    pthread_cond_init(&checkpoint->done, NULL);
+
+    if(pthread_create(&checkpoint->thread, NULL, checkpoint_loop, checkpoint))
+    {
+        gs_error_print("Could not start the checkpoint thread for %s", file_name);
+    }
+}
+
+// Only waits when the previous checkpoint is still being written
+void checkpoint_push(checkpoint_t *checkpoint, chemicals_t const *chem, u64 step)
+{
+    pthread_mutex_lock(&checkpoint->lock);
+    if(checkpoint->pending)
+    {
+        const f64 start = omp_get_wtime();
+        while(checkpoint->pending)
+            pthread_cond_wait(&checkpoint->done, &checkpoint->lock);
+
+        checkpoint->stall_time += omp_get_wtime() - start;
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+
+    copy_chemicals(&checkpoint->buffer, chem);
+    checkpoint->step = step;
+
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->pending = 1;
+    checkpoint->nb_checkpoints++;
+    pthread_cond_signal(&checkpoint->not_empty);
+    pthread_mutex_unlock(&checkpoint->lock);
+}
+
+void checkpoint_close(checkpoint_t *checkpoint)
+{
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->closing = 1;
+    pthread_cond_signal(&checkpoint->not_empty);
+    pthread_mutex_unlock(&checkpoint->lock);
+
+    pthread_join(checkpoint->thread, NULL);
+
+    if(checkpoint->nb_checkpoints)
+    {
+        gs_info_print("Checkpoints : %lld written in %.3lf s, stalled for %.3lf s",
+                      checkpoint->nb_checkpoints, checkpoint->write_time,
+                      checkpoint->stall_time);
+    }
+
+    pthread_cond_destroy(&checkpoint->done);
+    pthread_cond_destroy(&checkpoint->not_empty);
+    pthread_mutex_destroy(&checkpoint->lock);
+
+    free_chemicals(&checkpoint->buffer);
+    free(checkpoint->tmp_name);
+}
+
+chemicals_t checkpoint_load(char const *file_name, u64 *step)
+{
+    snapshot_reader_t reader = snapshot_open(file_name);
+    if(!reader.nb_frames)
+    {
+        gs_error_print("No frame to restart from in %s", file_name);
+    }
+
+    if(reader.header.codec == SNAPSHOT_QUANTIZE)
+    {
+        gs_warn_print("%s is lossy, the restart is not exact (error bound %g)",
+                      file_name, reader.header.error_bound);
+    }
+
+    chemicals_t frame = snapshot_frame(&reader, reader.nb_frames - 1, step);
+    chemicals_t state = from_scalar_layout(&frame);
+    snapshot_reader_close(&reader);
+
+    gs_info_print("Restarting from step %lld of %s (%lld x %lld)",
+                  *step, file_name, state.num_rows, state.y_size - 2);
+    return state;
+}
@@ -1,6 +1,9 @@
 #include "cli_handler.h"
+#include "constants.h"
 #include "logs.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -11,19 +14,44 @@ typedef struct arguments_s
     u8 value;
 } arguments_t;
 
-static const int nb_opts        = 6;
-static const int max_args_count = 17;
+static const int nb_opts        = 31;
+static const int max_args_count = 22;
 static const int max_digits     = 15;
+static const int max_line       = 256;
 
-// Opt in for output and opt in for benchmark mode
-static const arguments_t arguments[6] = 
+static const arguments_t arguments[31] = 
 {
     {'r', "-num_rows"        , 1},
     {'c', "-num_cols"        , 1},
     {'f', "-output_frequency", 1},
     {'s', "-simulation_steps", 1},
     {'o', "-output_file"     , 1},
-    {'i', "-interactive"     , 0}
+    {'i', "-interactive"     , 0},
+    {'t', "-temporal_block"  , 1},
+    {'d', "-domains"         , 1},
+    {'p', "-huge_pages"      , 0},
+    {'z', "-compression"     , 1},
+    {'e', "-error_bound"     , 1},
+    {'q', "-queue_size"      , 1},
+    {'k', "-checkpoint_frequency", 1},
+    {'K', "-checkpoint_file" , 1},
+    {'R', "-restart"         , 1},
+    {'b', "-benchmark"       , 1},
+    {'w', "-warmup"          , 1},
+    {'F', "-feed_rate"       , 1},
+    {'L', "-kill_rate"       , 1},
+    {'U', "-diffusion_u"     , 1},
+    {'V', "-diffusion_v"     , 1},
+    {'T', "-delta_t"         , 1},
+    {'C', "-config"          , 1},
+    {'E', "-ensemble"        , 1},
+    {'G', "-rate_gradient"   , 1},
+    {'x', "-export"          , 1},
+    {'j', "-export_threads"  , 1},
+    {'a', "-analytics"       , 1},
+    {'n', "-analytics_frequency", 1},
+    {'y', "-steady_threshold", 1},
+    {'Y', "-steady_steps"    , 1}
 };
 
 static void print_helper(char *prog_name)
@@ -54,6 +82,68 @@ static u8 string_is_digit(char *string, size_t len)
     return 0;
 }
 
+// The build assumes finite math (-Ofast), which folds isfinite to true :
+// the exponent bits are checked instead, all ones for nan and inf
+static u8 is_finite(f64 value)
+{
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return ((bits >> 52) & 0x7FFULL) != 0x7FFULL;
+}
+
+// Whole string as a finite real number
+static u8 string_to_real(char const *string, f64 *value)
+{
+    char *end = NULL;
+    *value = strtod(string, &end);
+    return (end == string) || (*end != '\0') || !is_finite(*value);
+}
+
+// Model parameters, one "name = value" per line, '#' starting a comment.
+// Names are the long options : feed_rate, kill_rate, diffusion_u,
+// diffusion_v and delta_t
+static void read_config(char const *file_name, args_t *args)
+{
+    FILE *fp = fopen(file_name, "r");
+    if(!fp)
+    {
+        gs_error_print("Could not open the config file %s", file_name);
+    }
+
+    char line[max_line];
+    u64 line_number = 0;
+    while(fgets(line, max_line, fp))
+    {
+        line_number++;
+
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        char name[32];
+        char value[64];
+        int nb_read = sscanf(line, " %31[a-z_] = %63s", name, value);
+        // Blank line
+        if(nb_read == EOF)
+            continue;
+
+        f64 *field = NULL;
+        if(nb_read == 2)
+        {
+            if(!strcmp(name, "feed_rate"))          field = &args->feed_rate;
+            else if(!strcmp(name, "kill_rate"))     field = &args->kill_rate;
+            else if(!strcmp(name, "diffusion_u"))   field = &args->diffusion_u;
+            else if(!strcmp(name, "diffusion_v"))   field = &args->diffusion_v;
+            else if(!strcmp(name, "delta_t"))       field = &args->delta_t;
+        }
+
+        if(!field || string_to_real(value, field))
+        {
+            gs_error_print("Invalid line %lld of %s : %s", line_number, file_name, line);
+        }
+    }
+
+    fclose(fp);
+}
+
 void parse_arguments(int argc, char *argv[argc+1], args_t *args)
 {
     args->num_rows          = 10;
@@ -62,6 +152,30 @@ void parse_arguments(int argc, char *argv[argc+1], args_t *args)
     args->steps             = 20;
     args->file_name         = "output.bin";
     args->interactive       = 0;
+    args->temporal_block    = 1;
+    args->nb_domains        = 1;
+    args->huge_pages        = 0;
+    args->compression       = 1;
+    args->error_bound       = 0.0;
+    args->queue_size        = 2;
+    args->checkpoint_frequency  = 0;
+    args->checkpoint_file       = "checkpoint.bin";
+    args->restart_file          = NULL;
+    args->benchmark             = 0;
+    args->warmup                = 10;
+    args->feed_rate             = FEEDRATE;
+    args->kill_rate             = KILLRATE;
+    args->diffusion_u           = DIFFUSION_RATE_U;
+    args->diffusion_v           = DIFFUSION_RATE_V;
+    args->delta_t               = DELTA_T;
+    args->ensemble_file         = NULL;
+    args->rate_gradient         = 0;
+    args->export_file           = NULL;
+    args->export_threads        = 2;
+    args->analytics_file        = NULL;
+    args->analytics_frequency   = 0;
+    args->steady_threshold      = 0.0;
+    args->steady_steps          = 100;
 
     if(argc == 1)
         return;
@@ -142,6 +256,210 @@ void parse_arguments(int argc, char *argv[argc+1], args_t *args)
                 }
                 args->interactive = (u8)strtoul(next_arg, NULL, 10);
             }
+            else if((*curr_arg == arguments[6].flag) || 
+                !strncmp(curr_arg, arguments[6].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len) || !strtoul(next_arg, NULL, 10))
+                {
+                    goto invalid_argument;
+                }
+                args->temporal_block = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[7].flag) || 
+                !strncmp(curr_arg, arguments[7].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->nb_domains = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[8].flag) || 
+                !strncmp(curr_arg, arguments[8].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->huge_pages = (u8)strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[9].flag) || 
+                !strncmp(curr_arg, arguments[9].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->compression = (u8)strtoul(next_arg, NULL, 10);
+                if(args->compression > 2)
+                    goto invalid_argument;
+            }
+            else if((*curr_arg == arguments[10].flag) || 
+                !strncmp(curr_arg, arguments[10].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->error_bound))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[11].flag) || 
+                !strncmp(curr_arg, arguments[11].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->queue_size = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[12].flag) || 
+                !strncmp(curr_arg, arguments[12].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->checkpoint_frequency = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[13].flag) || 
+                !strncmp(curr_arg, arguments[13].long_flag, max_args_count))
+            {
+                args->checkpoint_file = next_arg;
+            }
+            else if((*curr_arg == arguments[14].flag) || 
+                !strncmp(curr_arg, arguments[14].long_flag, max_args_count))
+            {
+                args->restart_file = next_arg;
+            }
+            else if((*curr_arg == arguments[15].flag) || 
+                !strncmp(curr_arg, arguments[15].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->benchmark = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[16].flag) || 
+                !strncmp(curr_arg, arguments[16].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->warmup = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[17].flag) || 
+                !strncmp(curr_arg, arguments[17].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->feed_rate))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[18].flag) || 
+                !strncmp(curr_arg, arguments[18].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->kill_rate))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[19].flag) || 
+                !strncmp(curr_arg, arguments[19].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->diffusion_u))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[20].flag) || 
+                !strncmp(curr_arg, arguments[20].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->diffusion_v))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[21].flag) || 
+                !strncmp(curr_arg, arguments[21].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->delta_t))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[22].flag) || 
+                !strncmp(curr_arg, arguments[22].long_flag, max_args_count))
+            {
+                // Options given after -C override the file
+                read_config(next_arg, args);
+            }
+            else if((*curr_arg == arguments[23].flag) || 
+                !strncmp(curr_arg, arguments[23].long_flag, max_args_count))
+            {
+                args->ensemble_file = next_arg;
+            }
+            else if((*curr_arg == arguments[24].flag) || 
+                !strncmp(curr_arg, arguments[24].long_flag, max_args_count))
+            {
+                // feed_min:feed_max:kill_min:kill_max
+                char end;
+                if((sscanf(next_arg, "%lf:%lf:%lf:%lf%c", &args->feed_range[0], 
+                           &args->feed_range[1], &args->kill_range[0], 
+                           &args->kill_range[1], &end) != 4)
+                || !is_finite(args->feed_range[0]) || !is_finite(args->feed_range[1])
+                || !is_finite(args->kill_range[0]) || !is_finite(args->kill_range[1]))
+                {
+                    goto invalid_argument;
+                }
+                args->rate_gradient = 1;
+            }
+            else if((*curr_arg == arguments[25].flag) || 
+                !strncmp(curr_arg, arguments[25].long_flag, max_args_count))
+            {
+                args->export_file = next_arg;
+            }
+            else if((*curr_arg == arguments[26].flag) || 
+                !strncmp(curr_arg, arguments[26].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len) || !strtoul(next_arg, NULL, 10))
+                {
+                    goto invalid_argument;
+                }
+                args->export_threads = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[27].flag) || 
+                !strncmp(curr_arg, arguments[27].long_flag, max_args_count))
+            {
+                args->analytics_file = next_arg;
+            }
+            else if((*curr_arg == arguments[28].flag) || 
+                !strncmp(curr_arg, arguments[28].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len))
+                {
+                    goto invalid_argument;
+                }
+                args->analytics_frequency = strtoul(next_arg, NULL, 10);
+            }
+            else if((*curr_arg == arguments[29].flag) || 
+                !strncmp(curr_arg, arguments[29].long_flag, max_args_count))
+            {
+                if(string_to_real(next_arg, &args->steady_threshold) 
+                || (args->steady_threshold < 0.0))
+                {
+                    goto invalid_argument;
+                }
+            }
+            else if((*curr_arg == arguments[30].flag) || 
+                !strncmp(curr_arg, arguments[30].long_flag, max_args_count))
+            {
+                if(string_is_digit(next_arg, len) || !strtoul(next_arg, NULL, 10))
+                {
+                    goto invalid_argument;
+                }
+                args->steady_steps = strtoul(next_arg, NULL, 10);
+            }
             else
             {
                 goto unknown_flag; 
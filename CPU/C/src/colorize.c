@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include <omp.h>
+
+#include "colorize.h"
+#include "colormap.h"
+#include "logs.h"
+
+// Grid columns (image rows) colour-mapped by a thread at once
+#define COLORIZE_BLOCK_Y    16ULL
+
+// Widest SIMD layout, 16 floats of AVX-512
+#define COLORIZE_MAX_LANES  16ULL
+
+#define COLORMAP_SIZE       (sizeof(colormap) / sizeof(colormap[0]))
+#define COLORMAP_LAST       ((real)(COLORMAP_SIZE - 1))
+
+// The palette spans v in [0, 0.5], the values the model reaches
+#define COLORMAP_SCALE      (REAL_TYPE(2.0) * COLORMAP_LAST)
+
+// Quantization saturates at both ends of the palette. The clamps are
+// selects (min/max instructions) so that the loops calling it vectorize
+// down to the gather in the colormap
+static inline u32 color_of(real v)
+{
+    real x = v * COLORMAP_SCALE;
+    x = (x < REAL_TYPE(0.0)) ? REAL_TYPE(0.0) : x;
+    x = (x > COLORMAP_LAST)  ? COLORMAP_LAST  : x;
+
+    return colormap[(u32)x];
+}
+
+// The row r of the grid is the row r % n + 1 of the lane r / n (n center
+// rows). Threads take blocks of grid columns and go through the rows of the
+// layout : the reads are contiguous, the colours of the lanes of a cell are
+// computed at once then move by one pixel from a row to the next
+static void colorize_full(chemicals_t const *chem, void *pixels, u64 pitch)
+{
+    const u64 simd_width        = chem->simd_width;
+    const u64 num_center_rows   = chem->x_size - 2;
+    const u64 num_rows          = chem->num_rows;
+    const u64 num_cols          = chem->y_size - 2;
+
+    const real (*restrict v_span)[chem->y_size][simd_width] =
+        make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+    #pragma omp parallel for schedule(static)
+    for(u64 j0 = 0; j0 < num_cols; j0 += COLORIZE_BLOCK_Y)
+    {
+        const u64 j1 = (j0 + COLORIZE_BLOCK_Y < num_cols) ? j0 + COLORIZE_BLOCK_Y : num_cols;
+        u32 colors[COLORIZE_MAX_LANES];
+
+        for(u64 i = 1; i <= num_center_rows; i++)
+        {
+            for(u64 j = j0; j < j1; j++)
+            {
+                #pragma omp simd
+                for(u64 k = 0; k < simd_width; k++)
+                    colors[k] = color_of(v_span[i][j + 1][k]);
+
+                u32 *image_row = (u32 *)((u8 *)pixels + j * pitch);
+
+                // The padding rows are at the end of the last lanes
+                for(u64 k = 0, row = i - 1; (k < simd_width) && (row < num_rows);
+                    k++, row += num_center_rows)
+                {
+                    image_row[row] = colors[k];
+                }
+            }
+        }
+    }
+}
+
+// Mean of v over the cells of every pixel, which covers view->num_rows /
+// width rows and view->num_cols / height columns (at least one of each).
+// For an image row, the columns of its cells are first summed for every
+// row of the view, W lanes at a time along the layout, then every pixel
+// adds up its rows. Each cell of the view is read once per frame
+static void colorize_box(chemicals_t const *chem, viewport_t const *view, 
+                         colorize_buffers_t const *buffers, void *pixels, 
+                         u64 pitch, u64 width, u64 height)
+{
+    const u64 simd_width        = chem->simd_width;
+    const u64 num_center_rows   = chem->x_size - 2;
+
+    const real (*restrict v_span)[chem->y_size][simd_width] =
+        make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+    // Rows of the layout holding the view, all of them once it spans lanes
+    const u64 last_row  = view->row + view->num_rows - 1;
+    u64 first_i         = 1;
+    u64 last_i          = num_center_rows;
+    if(view->row / num_center_rows == last_row / num_center_rows)
+    {
+        first_i = view->row % num_center_rows + 1;
+        last_i  = last_row % num_center_rows + 1;
+    }
+
+    // First row of every pixel column, and where the column sums of the 
+    // rows of the view are
+    u64 *restrict row_starts    = buffers->row_starts;
+    u64 *restrict row_offsets   = buffers->row_offsets;
+
+    for(u64 x = 0; x <= width; x++)
+        row_starts[x] = x * view->num_rows / width;
+
+    for(u64 r = 0; r < view->num_rows; r++)
+    {
+        const u64 row   = view->row + r;
+        row_offsets[r]  = (row % num_center_rows) * simd_width + row / num_center_rows;
+    }
+
+    const int max_threads   = omp_get_max_threads();
+    const int nb_threads    = ((u64)max_threads < buffers->nb_threads) ? max_threads 
+                                                                       : (int)buffers->nb_threads;
+
+    #pragma omp parallel num_threads(nb_threads)
+    {
+        real *sums = buffers->sums + (u64)omp_get_thread_num() * buffers->sums_size;
+
+        #pragma omp for schedule(static)
+        for(u64 y = 0; y < height; y++)
+        {
+            const u64 col_start = view->col + y * view->num_cols / height;
+            u64 col_end         = view->col + (y + 1) * view->num_cols / height;
+            if(col_end == col_start)
+                col_end = col_start + 1;
+
+            for(u64 i = first_i; i <= last_i; i++)
+            {
+                real *restrict lanes = sums + (i - 1) * simd_width;
+
+                #pragma omp simd
+                for(u64 k = 0; k < simd_width; k++)
+                    lanes[k] = REAL_TYPE(0.0);
+
+                for(u64 j = col_start; j < col_end; j++)
+                {
+                    #pragma omp simd
+                    for(u64 k = 0; k < simd_width; k++)
+                        lanes[k] += v_span[i][j + 1][k];
+                }
+            }
+
+            u32 *image_row = (u32 *)((u8 *)pixels + y * pitch);
+            for(u64 x = 0; x < width; x++)
+            {
+                const u64 r0 = row_starts[x];
+                const u64 r1 = (row_starts[x + 1] > r0) ? row_starts[x + 1] : r0 + 1;
+
+                real sum = REAL_TYPE(0.0);
+                for(u64 r = r0; r < r1; r++)
+                    sum += sums[row_offsets[r]];
+
+                image_row[x] = color_of(sum / (real)((r1 - r0) * (col_end - col_start)));
+            }
+        }
+    }
+}
+
+colorize_buffers_t new_colorize_buffers(chemicals_t const *like, u64 width, u64 nb_threads)
+{
+    assert(width && nb_threads);
+
+    colorize_buffers_t buffers;
+    buffers.width       = width;
+    buffers.nb_threads  = nb_threads;
+    buffers.sums_size   = (like->x_size - 2) * like->simd_width;
+    buffers.row_starts  = (u64 *)malloc((width + 1) * sizeof(u64));
+    buffers.row_offsets = (u64 *)malloc(like->num_rows * sizeof(u64));
+    buffers.sums        = (real *)malloc(nb_threads * buffers.sums_size * sizeof(real));
+    if(!buffers.row_starts || !buffers.row_offsets || !buffers.sums)
+    {
+        gs_error_print("Could not allocate the box filter of %lld pixels", width);
+    }
+
+    return buffers;
+}
+
+void free_colorize_buffers(colorize_buffers_t *buffers)
+{
+    free(buffers->row_starts);
+    free(buffers->row_offsets);
+    free(buffers->sums);
+}
+
+void colorize(chemicals_t const *chem, viewport_t const *view, 
+              colorize_buffers_t const *buffers, void *pixels, u64 pitch,
+              u64 width, u64 height)
+{
+    const viewport_t grid = { 0, 0, chem->num_rows, chem->y_size - 2 };
+    if(!view)
+        view = &grid;
+
+    assert(chem->simd_width <= COLORIZE_MAX_LANES);
+    assert(view->num_rows && view->num_cols);
+    assert(view->row + view->num_rows <= grid.num_rows && view->col + view->num_cols <= grid.num_cols);
+    assert(pitch >= width * sizeof(u32));
+    assert(width && (width <= buffers->width));
+    assert(buffers->sums_size == (chem->x_size - 2) * chem->simd_width);
+
+    if((view->num_rows == grid.num_rows) && (view->num_cols == grid.num_cols)
+    && (width == grid.num_rows) && (height == grid.num_cols))
+        colorize_full(chem, pixels, pitch);
+    else
+        colorize_box(chem, view, buffers, pixels, pitch, width, height);
+}
@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <omp.h>
+
+#include "domain.h"
+#include "logs.h"
+
+#define LEFT    0ULL
+#define RIGHT   1ULL
+
+static inline real *ring_slot(domains_t const *domains, u64 d, u64 slot,
+                              u64 side, u64 member)
+{
+    return domains->ring + ((((d * 2 + slot) * 2 + side) * 2 + member)
+                         * domains->column_size);
+}
+
+static void copy_column(chemicals_t const *chem, u64 j, real *u_col, real *v_col)
+{
+    const u64 simd_width = chem->simd_width;
+
+    const real (*restrict u_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->u, chem->y_size, simd_width);
+
+    const real (*restrict v_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+    for(u64 i = 0; i < chem->x_size; i++)
+    {
+        memcpy(u_col + i * simd_width, &u_span[i][j][0], simd_width * sizeof(real));
+        memcpy(v_col + i * simd_width, &v_span[i][j][0], simd_width * sizeof(real));
+    }
+}
+
+static void paste_column(chemicals_t *chem, u64 j, real const *u_col, real const *v_col)
+{
+    const u64 simd_width = chem->simd_width;
+
+    real (*restrict u_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->u, chem->y_size, simd_width);
+
+    real (*restrict v_span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+    for(u64 i = 0; i < chem->x_size; i++)
+    {
+        memcpy(&u_span[i][j][0], u_col + i * simd_width, simd_width * sizeof(real));
+        memcpy(&v_span[i][j][0], v_col + i * simd_width, simd_width * sizeof(real));
+    }
+}
+
+// Publishes the edge columns of the subdomain d in its ring slot
+static void pack_halos(domains_t const *domains, u64 d, u64 slot, chemicals_t const *chem)
+{
+    copy_column(chem, 1,
+                ring_slot(domains, d, slot, LEFT, 0),
+                ring_slot(domains, d, slot, LEFT, 1));
+
+    copy_column(chem, chem->y_size - 2,
+                ring_slot(domains, d, slot, RIGHT, 0),
+                ring_slot(domains, d, slot, RIGHT, 1));
+}
+
+// Fetches the edge columns of the neighbours of d, the outer halos of the
+// first and last subdomains are the zero boundary of the grid
+static void unpack_halos(domains_t const *domains, u64 d, u64 slot, chemicals_t *chem)
+{
+    if(d > 0)
+    {
+        paste_column(chem, 0,
+                     ring_slot(domains, d - 1, slot, RIGHT, 0),
+                     ring_slot(domains, d - 1, slot, RIGHT, 1));
+    }
+
+    if(d + 1 < domains->nb_domains)
+    {
+        paste_column(chem, chem->y_size - 1,
+                     ring_slot(domains, d + 1, slot, LEFT, 0),
+                     ring_slot(domains, d + 1, slot, LEFT, 1));
+    }
+}
+
+static inline void check_team(domains_t const *domains)
+{
+    if((u64)omp_get_num_threads() != domains->nb_domains)
+    {
+        gs_error_print("Only %d threads available for %lld subdomains",
+                       omp_get_num_threads(), domains->nb_domains);
+    }
+}
+
+domains_t new_domains(u64 x, u64 y, u64 nb_domains)
+{
+    assert(nb_domains > 0);
+    if(y < nb_domains)
+    {
+        gs_error_print("Cannot split %lld columns in %lld subdomains", y, nb_domains);
+    }
+
+    domains_t domains;
+    domains.nb_domains  = nb_domains;
+    domains.num_rows    = x;
+    domains.num_cols    = y;
+    domains.step        = 0;
+
+    u64 max_threads     = (u64)omp_get_max_threads();
+    domains.team_size   = (max_threads > nb_domains) ? max_threads / nb_domains : 1;
+
+    domains.col_start   = (u64 *)malloc((nb_domains + 1) * sizeof(u64));
+    domains.in          = (chemicals_t *)malloc(nb_domains * sizeof(chemicals_t));
+    domains.out         = (chemicals_t *)malloc(nb_domains * sizeof(chemicals_t));
+    if(!domains.col_start || !domains.in || !domains.out)
+    {
+        gs_error_print("Could not allocate the descriptors of %lld subdomains", nb_domains);
+    }
+
+    for(u64 d = 0; d <= nb_domains; d++)
+        domains.col_start[d] = (d * y) / nb_domains;
+
+    const u64 simd_width        = detect_simd_width();
+    const u64 num_center_rows   = (x + simd_width - 1) / simd_width;
+    domains.column_size         = (num_center_rows + 2) * simd_width;
+
+    const u64 ring_bytes = nb_domains * 8 * domains.column_size * sizeof(real);
+    domains.ring = (real *)malloc(ring_bytes);
+    if(!domains.ring)
+    {
+        gs_error_print("Could not allocate %lld bytes for the halo ring", ring_bytes);
+    }
+
+    omp_set_max_active_levels(2);
+
+    // Every group allocates its own subdomain so that its pages are
+    // first touched on its own NUMA node
+    #pragma omp parallel num_threads(nb_domains) proc_bind(spread)
+    {
+        check_team(&domains);
+        const u64 d = (u64)omp_get_thread_num();
+        omp_set_num_threads((int)domains.team_size);
+
+        const u64 nb_cols = domains.col_start[d + 1] - domains.col_start[d];
+        domains.in[d]  = new_chemicals_block(x, y, domains.col_start[d], nb_cols);
+        domains.out[d] = zeros_chemicals(x, nb_cols);
+
+        pack_halos(&domains, d, 0, &domains.in[d]);
+        #pragma omp barrier
+        unpack_halos(&domains, d, 0, &domains.in[d]);
+    }
+
+    gs_debug_print("%lld subdomains of %lld threads", nb_domains, domains.team_size);
+    return domains;
+}
+
+void free_domains(domains_t *domains)
+{
+    for(u64 d = 0; d < domains->nb_domains; d++)
+    {
+        free_chemicals(&domains->in[d]);
+        free_chemicals(&domains->out[d]);
+    }
+
+    free(domains->ring);
+    free(domains->in);
+    free(domains->out);
+    free(domains->col_start);
+}
+
+// Every subdomain steps on its own, then publishes its edges in the ring
+// slot of the step. Slots alternate between steps so that a single barrier
+// per step is enough : a slot is only overwritten two steps later, once all
+// the groups went through the next barrier (so are done reading it).
+real domains_run(domains_t *domains, u64 nb_steps)
+{
+    omp_set_max_active_levels(2);
+    real max_delta = REAL_TYPE(0.0);
+
+    #pragma omp parallel num_threads(domains->nb_domains) proc_bind(spread) \
+                         reduction(max:max_delta)
+    {
+        check_team(domains);
+        const u64 d = (u64)omp_get_thread_num();
+        omp_set_num_threads((int)domains->team_size);
+
+        for(u64 s = 0; s < nb_steps; s++)
+        {
+            const u64 slot = (domains->step + s + 1) % 2;
+
+            const real delta = simulation_step(&domains->in[d], &domains->out[d]);
+            max_delta = (delta > max_delta) ? delta : max_delta;
+            pack_halos(domains, d, slot, &domains->out[d]);
+
+            #pragma omp barrier
+            unpack_halos(domains, d, slot, &domains->out[d]);
+            swap_chemicals(&domains->in[d], &domains->out[d]);
+        }
+    }
+    domains->step += nb_steps;
+
+    return max_delta;
+}
+
+// Copies the current state of every subdomain into a (num_rows, num_cols)
+// grid such as the ones made by new_chemicals/zeros_chemicals
+void domains_gather(domains_t const *domains, chemicals_t *global)
+{
+    assert(global->num_rows == domains->num_rows);
+    assert(global->y_size == domains->num_cols + 2);
+    assert(global->simd_width == domains->in[0].simd_width);
+
+    const u64 simd_width = global->simd_width;
+
+    real (*restrict u_out)[global->y_size][simd_width]
+        = make_3D_span(real, restrict, global->u, global->y_size, simd_width);
+
+    real (*restrict v_out)[global->y_size][simd_width]
+        = make_3D_span(real, restrict, global->v, global->y_size, simd_width);
+
+    for(u64 d = 0; d < domains->nb_domains; d++)
+    {
+        chemicals_t const *chem = &domains->in[d];
+        const u64 nb_cols = chem->y_size - 2;
+
+        const real (*restrict u_in)[chem->y_size][simd_width]
+            = make_3D_span(real, restrict, chem->u, chem->y_size, simd_width);
+
+        const real (*restrict v_in)[chem->y_size][simd_width]
+            = make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+        #pragma omp parallel for
+        for(u64 i = 0; i < global->x_size; i++)
+        {
+            memcpy(&u_out[i][domains->col_start[d] + 1][0], &u_in[i][1][0],
+                   nb_cols * simd_width * sizeof(real));
+            memcpy(&v_out[i][domains->col_start[d] + 1][0], &v_in[i][1][0],
+                   nb_cols * simd_width * sizeof(real));
+        }
+    }
+}
+
+// Inverse of domains_gather, every subdomain takes its columns of the grid
+// along with the halo columns around them
+void domains_scatter(domains_t *domains, chemicals_t const *global)
+{
+    assert(global->num_rows == domains->num_rows);
+    assert(global->y_size == domains->num_cols + 2);
+    assert(global->simd_width == domains->in[0].simd_width);
+
+    const u64 simd_width = global->simd_width;
+
+    const real (*restrict u_in)[global->y_size][simd_width]
+        = make_3D_span(real, restrict, global->u, global->y_size, simd_width);
+
+    const real (*restrict v_in)[global->y_size][simd_width]
+        = make_3D_span(real, restrict, global->v, global->y_size, simd_width);
+
+    for(u64 d = 0; d < domains->nb_domains; d++)
+    {
+        chemicals_t *chem = &domains->in[d];
+
+        real (*restrict u_out)[chem->y_size][simd_width]
+            = make_3D_span(real, restrict, chem->u, chem->y_size, simd_width);
+
+        real (*restrict v_out)[chem->y_size][simd_width]
+            = make_3D_span(real, restrict, chem->v, chem->y_size, simd_width);
+
+        #pragma omp parallel for
+        for(u64 i = 0; i < global->x_size; i++)
+        {
+            memcpy(&u_out[i][0][0], &u_in[i][domains->col_start[d]][0],
+                   chem->y_size * simd_width * sizeof(real));
+            memcpy(&v_out[i][0][0], &v_in[i][domains->col_start[d]][0],
+                   chem->y_size * simd_width * sizeof(real));
+        }
+    }
+}
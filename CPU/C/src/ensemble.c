@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <omp.h>
+
+#include "ensemble.h"
+#include "logs.h"
+
+#define MAX_LINE        256
+#define NB_STATS        6
+
+// Mean and standard deviation of u and v, extrema of v
+enum { MEAN_U, STD_U, MEAN_V, STD_V, MIN_V, MAX_V };
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void push_member(ensemble_t *ensemble, u64 *capacity, f64 feed, f64 kill, u64 seed)
+{
+    if(ensemble->nb_members == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        ensemble->feed_rates = (real *)realloc(ensemble->feed_rates, *capacity * sizeof(real));
+        ensemble->kill_rates = (real *)realloc(ensemble->kill_rates, *capacity * sizeof(real));
+        ensemble->seeds      = (u64 *)realloc(ensemble->seeds, *capacity * sizeof(u64));
+        if(!ensemble->feed_rates || !ensemble->kill_rates || !ensemble->seeds)
+        {
+            gs_error_print("Could not allocate the parameters of %lld members", *capacity);
+        }
+    }
+
+    ensemble->feed_rates[ensemble->nb_members] = (real)feed;
+    ensemble->kill_rates[ensemble->nb_members] = (real)kill;
+    ensemble->seeds[ensemble->nb_members]      = seed;
+    ensemble->nb_members++;
+}
+
+static void read_members(char const *file_name, ensemble_t *ensemble)
+{
+    FILE *fp = fopen(file_name, "r");
+    if(!fp)
+    {
+        gs_error_print("Could not open the ensemble file %s", file_name);
+    }
+
+    u64 capacity = 0;
+    u64 line_number = 0;
+    char line[MAX_LINE];
+    while(fgets(line, MAX_LINE, fp))
+    {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        f64 feed, kill;
+        u64 seed = 0;
+        int nb_read = sscanf(line, "%lf %lf %llu", &feed, &kill, &seed);
+        if(nb_read == EOF)
+            continue;
+
+        if((nb_read < 2) || (feed < 0.0) || (kill < 0.0))
+        {
+            gs_error_print("Invalid line %lld of %s : %s", line_number, file_name, line);
+        }
+        push_member(ensemble, &capacity, feed, kill, seed);
+    }
+    fclose(fp);
+
+    if(!ensemble->nb_members)
+    {
+        gs_error_print("No member in the ensemble file %s", file_name);
+    }
+}
+
+// The lane k of a batch gets the initial state of its member,
+// an idle lane stays at zero
+static void seed_lane(chemicals_t *uv, u64 k, u64 seed)
+{
+    const u64 x = uv->x_size - 2;
+    const u64 y = uv->y_size - 2;
+
+    u64 x_start = ((7 * x) / 16) - 4;
+    u64 x_end   = ((8 * x) / 16) - 4;
+    u64 y_start = (7 * y) / 16;
+    u64 y_end   = (8 * y) / 16;
+
+    if(seed)
+    {
+        u64 state = seed * 0x9E3779B97F4A7C15ULL;
+        const u64 height = x_end - x_start;
+        const u64 width  = y_end - y_start;
+
+        x_start = next_random(&state) % (x - height + 1);
+        y_start = next_random(&state) % (y - width + 1);
+        x_end   = x_start + height;
+        y_end   = y_start + width;
+    }
+
+    real (*restrict u_span)[uv->y_size][uv->simd_width]
+        = make_3D_span(real, restrict, uv->u, uv->y_size, uv->simd_width);
+
+    real (*restrict v_span)[uv->y_size][uv->simd_width]
+        = make_3D_span(real, restrict, uv->v, uv->y_size, uv->simd_width);
+
+    for(u64 i = 0; i < x; i++)
+    {
+        for(u64 j = 0; j < y; j++)
+        {
+            real pattern = (real)( i >= x_start && i < x_end
+                                && j >= y_start && j < y_end);
+
+            u_span[i + 1][j + 1][k] = REAL_TYPE(1.0) - pattern;
+            v_span[i + 1][j + 1][k] = pattern;
+        }
+    }
+}
+
+ensemble_t new_ensemble(char const *file_name, u64 x, u64 y)
+{
+    ensemble_t ensemble;
+    memset(&ensemble, 0, sizeof(ensemble));
+    read_members(file_name, &ensemble);
+
+    if((x < 16) || (y < 16))
+    {
+        gs_error_print("Members of %lld x %lld cells are too small, 16 x 16 at least", x, y);
+    }
+
+    ensemble.num_rows   = x;
+    ensemble.num_cols   = y;
+    ensemble.simd_width = detect_simd_width();
+    ensemble.nb_batches = (ensemble.nb_members + ensemble.simd_width - 1) / ensemble.simd_width;
+
+    // Idle lanes of the last batch : no feed, no kill, no chemicals
+    const u64 nb_lanes = ensemble.nb_batches * ensemble.simd_width;
+    u64 capacity = ensemble.nb_members;
+    const u64 nb_members = ensemble.nb_members;
+    while(ensemble.nb_members < nb_lanes)
+        push_member(&ensemble, &capacity, 0.0, 0.0, 0);
+    ensemble.nb_members = nb_members;
+
+    ensemble.in  = (chemicals_t *)malloc(ensemble.nb_batches * sizeof(chemicals_t));
+    ensemble.out = (chemicals_t *)malloc(ensemble.nb_batches * sizeof(chemicals_t));
+    if(!ensemble.in || !ensemble.out)
+    {
+        gs_error_print("Could not allocate the descriptors of %lld batches", ensemble.nb_batches);
+    }
+
+    // Every batch is first touched by the thread that will step it
+    #pragma omp parallel for schedule(static)
+    for(u64 b = 0; b < ensemble.nb_batches; b++)
+    {
+        ensemble.in[b]  = zeros_chemicals(x * ensemble.simd_width, y);
+        ensemble.out[b] = zeros_chemicals(x * ensemble.simd_width, y);
+
+        for(u64 k = 0; k < ensemble.simd_width; k++)
+        {
+            const u64 m = b * ensemble.simd_width + k;
+            if(m < nb_members)
+                seed_lane(&ensemble.in[b], k, ensemble.seeds[m]);
+        }
+    }
+
+    gs_info_print("%lld members of %lld x %lld in %lld batches of %lld lanes",
+                  nb_members, x, y, ensemble.nb_batches, ensemble.simd_width);
+    return ensemble;
+}
+
+void free_ensemble(ensemble_t *ensemble)
+{
+    for(u64 b = 0; b < ensemble->nb_batches; b++)
+    {
+        free_chemicals(&ensemble->in[b]);
+        free_chemicals(&ensemble->out[b]);
+    }
+
+    free(ensemble->in);
+    free(ensemble->out);
+    free(ensemble->feed_rates);
+    free(ensemble->kill_rates);
+    free(ensemble->seeds);
+}
+
+void ensemble_run(ensemble_t *ensemble, u64 nb_steps)
+{
+    const u64 simd_width = ensemble->simd_width;
+
+    #pragma omp parallel for schedule(static)
+    for(u64 b = 0; b < ensemble->nb_batches; b++)
+    {
+        real const *feed_rates = ensemble->feed_rates + b * simd_width;
+        real const *kill_rates = ensemble->kill_rates + b * simd_width;
+
+        for(u64 s = 0; s < nb_steps; s++)
+        {
+            simulation_step_lanes(&ensemble->in[b], &ensemble->out[b],
+                                  feed_rates, kill_rates);
+            swap_chemicals(&ensemble->in[b], &ensemble->out[b]);
+        }
+    }
+    ensemble->step += nb_steps;
+}
+
+// Statistics of the center cells of every lane of a batch
+static void batch_stats(chemicals_t const *uv, f64 (*stats)[NB_STATS])
+{
+    const u64 simd_width = uv->simd_width;
+    const f64 nb_cells   = (f64)((uv->x_size - 2) * (uv->y_size - 2));
+
+    const real (*restrict u_span)[uv->y_size][simd_width]
+        = make_3D_span(real, restrict, uv->u, uv->y_size, simd_width);
+
+    const real (*restrict v_span)[uv->y_size][simd_width]
+        = make_3D_span(real, restrict, uv->v, uv->y_size, simd_width);
+
+    for(u64 k = 0; k < simd_width; k++)
+    {
+        f64 sum_u = 0.0, sum_v = 0.0, sq_u = 0.0, sq_v = 0.0;
+        f64 min_v = (f64)v_span[1][1][k];
+        f64 max_v = min_v;
+
+        for(u64 i = 1; i < uv->x_size - 1; i++)
+        {
+            for(u64 j = 1; j < uv->y_size - 1; j++)
+            {
+                const f64 u = (f64)u_span[i][j][k];
+                const f64 v = (f64)v_span[i][j][k];
+                sum_u += u;
+                sum_v += v;
+                sq_u  += u * u;
+                sq_v  += v * v;
+                min_v  = (v < min_v) ? v : min_v;
+                max_v  = (v > max_v) ? v : max_v;
+            }
+        }
+
+        const f64 mean_u = sum_u / nb_cells;
+        const f64 mean_v = sum_v / nb_cells;
+        stats[k][MEAN_U] = mean_u;
+        stats[k][STD_U]  = sqrt(fmax(sq_u / nb_cells - mean_u * mean_u, 0.0));
+        stats[k][MEAN_V] = mean_v;
+        stats[k][STD_V]  = sqrt(fmax(sq_v / nb_cells - mean_v * mean_v, 0.0));
+        stats[k][MIN_V]  = min_v;
+        stats[k][MAX_V]  = max_v;
+    }
+}
+
+void ensemble_write_header(FILE *fp)
+{
+    fprintf(fp, "member,feed_rate,kill_rate,seed,step,mean_u,std_u,mean_v,std_v,min_v,max_v\n");
+}
+
+void ensemble_write_stats(ensemble_t const *ensemble, FILE *fp)
+{
+    const u64 nb_lanes = ensemble->nb_batches * ensemble->simd_width;
+    f64 (*stats)[NB_STATS] = (f64 (*)[NB_STATS])malloc(nb_lanes * sizeof(*stats));
+    if(!stats)
+    {
+        gs_error_print("Could not allocate the statistics of %lld members", nb_lanes);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(u64 b = 0; b < ensemble->nb_batches; b++)
+        batch_stats(&ensemble->in[b], stats + b * ensemble->simd_width);
+
+    for(u64 m = 0; m < ensemble->nb_members; m++)
+    {
+        fprintf(fp, "%llu,%.6g,%.6g,%llu,%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+                m, (f64)ensemble->feed_rates[m], (f64)ensemble->kill_rates[m],
+                ensemble->seeds[m], ensemble->step,
+                stats[m][MEAN_U], stats[m][STD_U], stats[m][MEAN_V],
+                stats[m][STD_V], stats[m][MIN_V], stats[m][MAX_V]);
+    }
+    fflush(fp);
+
+    free(stats);
+}
@@ -0,0 +1,381 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <omp.h>
+#include <zlib.h>
+
+#include "exporter.h"
+#include "colorize.h"
+#include "logs.h"
+
+#define ALIGNMENT       64ULL
+
+// Frame rate written in the Y4M header
+#define EXPORT_FPS      30
+
+// Encoding favours throughput, frames are written at the simulation rate
+#define PNG_LEVEL       Z_BEST_SPEED
+
+// Buffers of a worker, allocated once
+typedef struct encoder_s
+{
+    u32 *rgba;
+    u8 *raw;
+    u8 *encoded;
+    u64 encoded_capacity;
+    colorize_buffers_t buffers;
+} encoder_t;
+
+static u8 const png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static inline u8 *put_u32_be(u8 *out, u32 value)
+{
+    out[0] = (u8)(value >> 24);
+    out[1] = (u8)(value >> 16);
+    out[2] = (u8)(value >> 8);
+    out[3] = (u8)(value);
+    return out + 4;
+}
+
+// Length, type, data then the CRC of the type and of the data
+static void write_png_chunk(FILE *fp, char const type[4], u8 const *data, u32 size)
+{
+    u8 header[8];
+    put_u32_be(header, size);
+    memcpy(header + 4, type, 4);
+
+    uLong crc = crc32(0L, header + 4, 4);
+    if(size)
+        crc = crc32(crc, data, size);
+
+    u8 footer[4];
+    put_u32_be(footer, (u32)crc);
+
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(data, 1, size, fp);
+    fwrite(footer, 1, sizeof(footer), fp);
+}
+
+// Red, green and blue of RGBA8888 pixels
+static void rgba_to_rgb(u32 const *rgba, u8 *rgb, u64 nb_pixels)
+{
+    for(u64 p = 0; p < nb_pixels; p++)
+    {
+        rgb[3 * p + 0] = (u8)(rgba[p] >> 24);
+        rgb[3 * p + 1] = (u8)(rgba[p] >> 16);
+        rgb[3 * p + 2] = (u8)(rgba[p] >> 8);
+    }
+}
+
+// Y, Cb and Cr planes, BT.601 studio range
+static void rgba_to_yuv444(u32 const *rgba, u8 *yuv, u64 nb_pixels)
+{
+    u8 *y_plane = yuv;
+    u8 *u_plane = yuv + nb_pixels;
+    u8 *v_plane = yuv + 2 * nb_pixels;
+
+    for(u64 p = 0; p < nb_pixels; p++)
+    {
+        const i32 r = (i32)((rgba[p] >> 24) & 0xFF);
+        const i32 g = (i32)((rgba[p] >> 16) & 0xFF);
+        const i32 b = (i32)((rgba[p] >> 8)  & 0xFF);
+
+        y_plane[p] = (u8)((( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16);
+        u_plane[p] = (u8)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+        v_plane[p] = (u8)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+    }
+}
+
+// v plane in the layout of like, u being NULL
+static chemicals_t new_slot(chemicals_t const *like)
+{
+    chemicals_t slot    = *like;
+    slot.nb_members     = 1;
+    slot.u              = NULL;
+
+    const u64 bytes = like->x_size * like->y_size * like->simd_width * sizeof(real);
+    slot.v = (real *)aligned_alloc(ALIGNMENT, ((bytes + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT);
+    if(!slot.v)
+    {
+        gs_error_print("Could not allocate %lld bytes for an exported frame", bytes);
+    }
+    return slot;
+}
+
+static FILE *open_frame(exporter_t const *exporter, u64 step)
+{
+    char name[4096];
+    snprintf(name, sizeof(name), "%s_%08llu.%s", exporter->stem, step, exporter->extension);
+
+    FILE *fp = fopen(name, "wb");
+    if(!fp)
+    {
+        gs_error_print("Could not open %s to export the step %lld", name, step);
+    }
+    return fp;
+}
+
+static void write_ppm(exporter_t const *exporter, encoder_t *encoder, u64 step)
+{
+    const u64 nb_pixels = exporter->width * exporter->height;
+    rgba_to_rgb(encoder->rgba, encoder->raw, nb_pixels);
+
+    FILE *fp = open_frame(exporter, step);
+    fprintf(fp, "P6\n%llu %llu\n255\n", exporter->width, exporter->height);
+    fwrite(encoder->raw, 1, 3 * nb_pixels, fp);
+    fclose(fp);
+}
+
+// Every row starts with the filter type, 0 (none) here
+static void write_png(exporter_t const *exporter, encoder_t *encoder, u64 step)
+{
+    const u64 row_bytes = 1 + 3 * exporter->width;
+    for(u64 j = 0; j < exporter->height; j++)
+    {
+        encoder->raw[j * row_bytes] = 0;
+        rgba_to_rgb(encoder->rgba + j * exporter->width, encoder->raw + j * row_bytes + 1,
+                    exporter->width);
+    }
+
+    uLongf encoded_size = (uLongf)encoder->encoded_capacity;
+    if(compress2(encoder->encoded, &encoded_size, encoder->raw,
+                 (uLong)(row_bytes * exporter->height), PNG_LEVEL) != Z_OK)
+    {
+        gs_error_print("Could not deflate the PNG of the step %lld", step);
+    }
+
+    // Width, height, 8 bits, RGB, deflate, no filter method, no interlacing
+    u8 ihdr[13];
+    put_u32_be(ihdr, (u32)exporter->width);
+    put_u32_be(ihdr + 4, (u32)exporter->height);
+    ihdr[8]  = 8;
+    ihdr[9]  = 2;
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    FILE *fp = open_frame(exporter, step);
+    fwrite(png_signature, 1, sizeof(png_signature), fp);
+    write_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    write_png_chunk(fp, "IDAT", encoder->encoded, (u32)encoded_size);
+    write_png_chunk(fp, "IEND", NULL, 0);
+    fclose(fp);
+}
+
+static void *worker_loop(void *arg)
+{
+    exporter_t *exporter = (exporter_t *)arg;
+
+    // Frames are encoded side by side, one thread each
+    omp_set_num_threads(1);
+
+    const u64 nb_pixels = exporter->width * exporter->height;
+    const u64 raw_bytes = exporter->height * (1 + 3 * exporter->width);
+
+    encoder_t encoder;
+    encoder.encoded_capacity = (exporter->format == EXPORT_PNG) ? compressBound((uLong)raw_bytes) : 0;
+    encoder.rgba    = (u32 *)malloc(nb_pixels * sizeof(u32));
+    encoder.raw     = (u8 *)malloc(raw_bytes);
+    encoder.encoded = (u8 *)malloc(encoder.encoded_capacity + 1);
+    if(!encoder.rgba || !encoder.raw || !encoder.encoded)
+    {
+        gs_error_print("Could not allocate the buffers of an encoder of %lld pixels", nb_pixels);
+    }
+    encoder.buffers = new_colorize_buffers(&exporter->slots[0], exporter->width, 1);
+
+    pthread_mutex_lock(&exporter->lock);
+    for(;;)
+    {
+        while((exporter->next_encode == exporter->next_push) && !exporter->closing)
+            pthread_cond_wait(&exporter->queued, &exporter->lock);
+
+        if(exporter->next_encode == exporter->next_push)
+            break;
+
+        const u64 frame = exporter->next_encode++;
+        const u64 slot  = frame % exporter->nb_slots;
+        const u64 step  = exporter->steps[slot];
+        pthread_mutex_unlock(&exporter->lock);
+
+        const f64 start = omp_get_wtime();
+        colorize(&exporter->slots[slot], NULL, &encoder.buffers, encoder.rgba, 
+                 exporter->width * sizeof(u32), exporter->width, exporter->height);
+
+        if(exporter->format == EXPORT_PPM)
+            write_ppm(exporter, &encoder, step);
+        else if(exporter->format == EXPORT_PNG)
+            write_png(exporter, &encoder, step);
+        else
+            rgba_to_yuv444(encoder.rgba, encoder.raw, nb_pixels);
+
+        const f64 elapsed = omp_get_wtime() - start;
+
+        pthread_mutex_lock(&exporter->lock);
+
+        // The stream gets the frames in order
+        while(exporter->next_write != frame)
+            pthread_cond_wait(&exporter->written, &exporter->lock);
+
+        if(exporter->format == EXPORT_Y4M)
+        {
+            fputs("FRAME\n", exporter->stream);
+            fwrite(encoder.raw, 1, 3 * nb_pixels, exporter->stream);
+        }
+
+        exporter->encode_time += elapsed;
+        exporter->next_write++;
+        exporter->busy[slot] = 0;
+        pthread_cond_broadcast(&exporter->written);
+        pthread_cond_signal(&exporter->freed);
+    }
+    pthread_mutex_unlock(&exporter->lock);
+
+    free(encoder.rgba);
+    free(encoder.raw);
+    free(encoder.encoded);
+    free_colorize_buffers(&encoder.buffers);
+
+    return NULL;
+}
+
+void exporter_init(exporter_t *exporter, char const *file_name,
+                   chemicals_t const *like, u64 nb_workers)
+{
+    assert(nb_workers > 0);
+
+    char const *dot = strrchr(file_name, '.');
+    if(!dot)
+    {
+        gs_error_print("No extension to choose the export format of %s", file_name);
+    }
+
+    if(!strcmp(dot, ".ppm"))
+        exporter->format = EXPORT_PPM;
+    else if(!strcmp(dot, ".png"))
+        exporter->format = EXPORT_PNG;
+    else if(!strcmp(dot, ".y4m"))
+        exporter->format = EXPORT_Y4M;
+    else
+    {
+        gs_error_print("Unknown export format %s, use .ppm, .png or .y4m", dot);
+    }
+
+    exporter->extension = dot + 1;
+    exporter->stem      = strndup(file_name, (size_t)(dot - file_name));
+    exporter->stream    = NULL;
+    exporter->width     = like->num_rows;
+    exporter->height    = like->y_size - 2;
+
+    if(exporter->format == EXPORT_Y4M)
+    {
+        exporter->stream = fopen(file_name, "wb");
+        if(!exporter->stream)
+        {
+            gs_error_print("Could not open %s to export the frames", file_name);
+        }
+        fprintf(exporter->stream, "YUV4MPEG2 W%llu H%llu F%d:1 Ip A1:1 C444\n",
+                exporter->width, exporter->height, EXPORT_FPS);
+    }
+
+    exporter->nb_workers    = nb_workers;
+    exporter->nb_slots      = 2 * nb_workers;
+    exporter->next_push     = 0;
+    exporter->next_encode   = 0;
+    exporter->next_write    = 0;
+    exporter->closing       = 0;
+    exporter->nb_stalls     = 0;
+    exporter->stall_time    = 0.0;
+    exporter->encode_time   = 0.0;
+
+    exporter->slots     = (chemicals_t *)malloc(exporter->nb_slots * sizeof(chemicals_t));
+    exporter->steps     = (u64 *)calloc(exporter->nb_slots, sizeof(u64));
+    exporter->busy      = (u8 *)calloc(exporter->nb_slots, sizeof(u8));
+    exporter->workers   = (pthread_t *)malloc(nb_workers * sizeof(pthread_t));
+    if(!exporter->stem || !exporter->slots || !exporter->steps || !exporter->busy
+    || !exporter->workers)
+    {
+        gs_error_print("Could not allocate the export queue of %s", file_name);
+    }
+
+    for(u64 s = 0; s < exporter->nb_slots; s++)
+        exporter->slots[s] = new_slot(like);
+
+    pthread_mutex_init(&exporter->lock, NULL);
+    pthread_cond_init(&exporter->queued, NULL);
+    pthread_cond_init(&exporter->freed, NULL);
+    pthread_cond_init(&exporter->written, NULL);
+
+    for(u64 w = 0; w < nb_workers; w++)
+    {
+        if(pthread_create(&exporter->workers[w], NULL, worker_loop, exporter))
+        {
+            gs_error_print("Could not start the export thread %lld", w);
+        }
+    }
+}
+
+void exporter_push(exporter_t *exporter, chemicals_t const *chem, u64 step)
+{
+    const u64 slot = exporter->next_push % exporter->nb_slots;
+
+    pthread_mutex_lock(&exporter->lock);
+    if(exporter->busy[slot])
+    {
+        const f64 start = omp_get_wtime();
+        while(exporter->busy[slot])
+            pthread_cond_wait(&exporter->freed, &exporter->lock);
+
+        exporter->stall_time += omp_get_wtime() - start;
+        exporter->nb_stalls++;
+    }
+    pthread_mutex_unlock(&exporter->lock);
+
+    chemicals_t *frame  = &exporter->slots[slot];
+    const u64 row_size  = chem->y_size * chem->simd_width;
+
+    assert(frame->x_size == chem->x_size && frame->y_size == chem->y_size);
+
+    #pragma omp parallel for schedule(static)
+    for(u64 i = 0; i < chem->x_size; i++)
+        memcpy(frame->v + i * row_size, chem->v + i * row_size, row_size * sizeof(real));
+
+    pthread_mutex_lock(&exporter->lock);
+    exporter->steps[slot] = step;
+    exporter->busy[slot]  = 1;
+    exporter->next_push++;
+    pthread_cond_signal(&exporter->queued);
+    pthread_mutex_unlock(&exporter->lock);
+}
+
+void exporter_close(exporter_t *exporter)
+{
+    pthread_mutex_lock(&exporter->lock);
+    exporter->closing = 1;
+    pthread_cond_broadcast(&exporter->queued);
+    pthread_mutex_unlock(&exporter->lock);
+
+    for(u64 w = 0; w < exporter->nb_workers; w++)
+        pthread_join(exporter->workers[w], NULL);
+
+    gs_info_print("Export : %lld frames, %.3lf s of encoding on %lld threads, "
+                  "%lld stalls for %.3lf s", exporter->next_write, exporter->encode_time,
+                  exporter->nb_workers, exporter->nb_stalls, exporter->stall_time);
+
+    if(exporter->stream)
+        fclose(exporter->stream);
+
+    pthread_cond_destroy(&exporter->written);
+    pthread_cond_destroy(&exporter->freed);
+    pthread_cond_destroy(&exporter->queued);
+    pthread_mutex_destroy(&exporter->lock);
+
+    for(u64 s = 0; s < exporter->nb_slots; s++)
+        free(exporter->slots[s].v);
+
+    free(exporter->workers);
+    free(exporter->busy);
+    free(exporter->steps);
+    free(exporter->slots);
+    free(exporter->stem);
+}
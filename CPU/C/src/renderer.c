@@ -1,60 +1,69 @@
 #include "renderer.h"
-#include "colormap.h"
+#include "colorize.h"
 #include "logs.h"
 #include <assert.h>
+#include <omp.h>
 
 #define MIN_SIZE_X  640
 #define MIN_SIZE_Y  360
 #define MAX_SIZE_X  1920
 #define MAX_SIZE_Y  1080
 
-SDL_config_t render_init(args_t *args)
+// The view is never smaller than that many cells along an axis
+#define MIN_VIEW_CELLS  16
+
+SDL_config_t render_init(args_t const *args, chemicals_t const *like)
 {
     SDL_config_t config;
 
-    config.dim_x = (u32)args->num_rows;
-    config.dim_y = (u32)args->num_cols;
-     
-    if(config.dim_x < MIN_SIZE_X)
-    {
-        gs_warn_print("Width dimensions is to small for visualization : %d", config.dim_x);
-        gs_info_print("Width has been set to the min size : %d", MIN_SIZE_X);
-    
-        config.dim_x    = MIN_SIZE_X;
-        args->num_rows  = MIN_SIZE_X;
-    }
-    else if(config.dim_x > MAX_SIZE_X)
-    {
-        gs_warn_print("Width dimension is to big for visualization : %d", config.dim_x);
-        gs_info_print("Width has been set to the max size : %d", MAX_SIZE_X);
-
-        config.dim_x    = MAX_SIZE_X;
-        args->num_rows  = MAX_SIZE_X;
-    }
+    config.grid_rows    = args->num_rows;
+    config.grid_cols    = args->num_cols;
+    config.zoom         = 0;
+    config.view_row     = 0.0;
+    config.view_col     = 0.0;
+
+    // The window shows the whole grid, scaled by an integer factor keeping
+    // its aspect ratio : reduced until it fits, magnified up to the min size.
+    // A very elongated grid keeps at least a pixel along its short side
+    u64 dim_x = args->num_rows;
+    u64 dim_y = args->num_cols;
     
-    if(config.dim_y < MIN_SIZE_Y)
+    const u64 reduce_x  = (dim_x + MAX_SIZE_X - 1) / MAX_SIZE_X;
+    const u64 reduce_y  = (dim_y + MAX_SIZE_Y - 1) / MAX_SIZE_Y;
+    const u64 reduce    = (reduce_x > reduce_y) ? reduce_x : reduce_y;
+    if(reduce > 1)
     {
-        gs_warn_print("Height dimension is to small for visualization : %d", config.dim_y);
-        gs_info_print("Height has been set to the min size : %d", MIN_SIZE_Y);
-    
-        config.dim_y    = MIN_SIZE_Y;
-        args->num_cols  = MIN_SIZE_Y;
+        dim_x = (dim_x / reduce) ? dim_x / reduce : 1;
+        dim_y = (dim_y / reduce) ? dim_y / reduce : 1;
+        gs_info_print("The grid is displayed reduced %lld times", reduce);
     }
-    else if(config.dim_y > MAX_SIZE_Y)
+    else if((dim_x < MIN_SIZE_X) || (dim_y < MIN_SIZE_Y))
     {
-        gs_warn_print("Height dimension is to big for visualization : %d", config.dim_y);
-        gs_info_print("Height has been set to the max size : %d", MAX_SIZE_Y);
-    
-        config.dim_y    = MAX_SIZE_Y;
-        args->num_cols  = MAX_SIZE_Y;
+        const u64 grow_x    = (MIN_SIZE_X + dim_x - 1) / dim_x;
+        const u64 grow_y    = (MIN_SIZE_Y + dim_y - 1) / dim_y;
+        const u64 fit_x     = MAX_SIZE_X / dim_x;
+        const u64 fit_y     = MAX_SIZE_Y / dim_y;
+
+        u64 grow        = (grow_x > grow_y) ? grow_x : grow_y;
+        const u64 fit   = (fit_x < fit_y) ? fit_x : fit_y;
+        if(grow > fit)
+            grow = fit;
+
+        dim_x *= grow;
+        dim_y *= grow;
+        gs_info_print("The grid is displayed magnified %lld times", grow);
     }
 
+    config.dim_x = (u32)dim_x;
+    config.dim_y = (u32)dim_y;
+
     config.window = SDL_CreateWindow("Gray Scott Simulation"
                 , SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED
                 , (i32)config.dim_x, (i32)config.dim_y, SDL_WINDOW_SHOWN);
 
+     // SDL_RenderPresent blocks the viewer thread until the next refresh
      config.renderer = SDL_CreateRenderer(config.window, -1
-                , SDL_RENDERER_ACCELERATED);
+                , SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
      config.texture = SDL_CreateTexture(config.renderer
                 , SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING
@@ -63,57 +72,113 @@ SDL_config_t render_init(args_t *args)
 
     gs_debug_print("Window size : %d %d", config.dim_x, config.dim_y);
 
+    // Sized for any team, frames are drawn by the one of the display
+    config.buffers = new_colorize_buffers(like, config.dim_x, (u64)omp_get_max_threads());
+
      return config;
 }
 
 void render_cleanup(SDL_config_t *config)
 {
+     free_colorize_buffers(&config->buffers);
      SDL_DestroyTexture(config->texture);
      SDL_DestroyRenderer(config->renderer);
      SDL_DestroyWindow(config->window);
      SDL_Quit();
 }
 
-// There is some padding to handle there
-void render_gray_scott(SDL_config_t config, chemicals_t const* chemical)
+static viewport_t current_view(SDL_config_t const *config)
 {
-    const real(* restrict v_map)[chemical->y_size] = 
-        make_2D_span(real, restrict, chemical->v, chemical->y_size);
-    
-    u64 nb_bytes    = (config.dim_x * config.dim_y) * sizeof(u32);
-    u32 *pixels     = (u32*)malloc(nb_bytes);
+    viewport_t view;
+    view.num_rows   = config->grid_rows >> config->zoom;
+    view.num_cols   = config->grid_cols >> config->zoom;
+    view.row        = (u64)config->view_row;
+    view.col        = (u64)config->view_col;
+    return view;
+}
 
-    assert(config.dim_x == chemical->x_size && config.dim_y == chemical->y_size);
-    if(!pixels)
+// Keeps the view inside the grid
+static void clamp_view(SDL_config_t *config)
+{
+    const viewport_t view = current_view(config);
+    const f64 max_row = (f64)(config->grid_rows - view.num_rows);
+    const f64 max_col = (f64)(config->grid_cols - view.num_cols);
+
+    config->view_row = (config->view_row < 0.0) ? 0.0 : config->view_row;
+    config->view_row = (config->view_row > max_row) ? max_row : config->view_row;
+    config->view_col = (config->view_col < 0.0) ? 0.0 : config->view_col;
+    config->view_col = (config->view_col > max_col) ? max_col : config->view_col;
+}
+
+u8 render_handle_event(SDL_config_t *config, SDL_Event const *event)
+{
+    const viewport_t view   = current_view(config);
+    const f64 rows_per_px   = (f64)view.num_rows / (f64)config->dim_x;
+    const f64 cols_per_px   = (f64)view.num_cols / (f64)config->dim_y;
+
+    if(event->type == SDL_MOUSEWHEEL)
+    {
+        u32 zoom = config->zoom;
+        if((event->wheel.y > 0) && ((config->grid_rows >> (zoom + 1)) >= MIN_VIEW_CELLS)
+                                && ((config->grid_cols >> (zoom + 1)) >= MIN_VIEW_CELLS))
+            zoom++;
+        else if((event->wheel.y < 0) && (zoom > 0))
+            zoom--;
+
+        if(zoom == config->zoom)
+            return 0;
+
+        // The cell under the cursor stays where it is
+        i32 mouse_x = 0;
+        i32 mouse_y = 0;
+        SDL_GetMouseState(&mouse_x, &mouse_y);
+
+        const f64 cell_row  = config->view_row + (f64)mouse_x * rows_per_px;
+        const f64 cell_col  = config->view_col + (f64)mouse_y * cols_per_px;
+        config->zoom        = zoom;
+
+        const viewport_t zoomed = current_view(config);
+        config->view_row = cell_row - (f64)mouse_x * (f64)zoomed.num_rows / (f64)config->dim_x;
+        config->view_col = cell_col - (f64)mouse_y * (f64)zoomed.num_cols / (f64)config->dim_y;
+    }
+    else if((event->type == SDL_MOUSEMOTION) && (event->motion.state & SDL_BUTTON_LMASK))
+    {
+        config->view_row -= (f64)event->motion.xrel * rows_per_px;
+        config->view_col -= (f64)event->motion.yrel * cols_per_px;
+    }
+    else if((event->type == SDL_KEYDOWN) && (event->key.keysym.sym == SDLK_r))
     {
-        gs_error_print("Couldnt allocate %lld bytes from memory for the rendering"
-                , nb_bytes);
+        config->zoom        = 0;
+        config->view_row    = 0.0;
+        config->view_col    = 0.0;
     }
+    else
+    {
+        return 0;
+    }
+
+    clamp_view(config);
+    return 1;
+}
 
-    u32 value = REAL_TYPE(0.0);
-    // Needs correction for the bounds of the render
-    for(u32 j = 0; j < config.dim_y; j++)
+// Pixels are written straight into the texture memory : a frame needs no
+// allocation, no layout change nor the copy of SDL_UpdateTexture
+void render_gray_scott(SDL_config_t config, chemicals_t const* chemical)
+{
+    assert(config.grid_rows == chemical->num_rows && config.grid_cols == chemical->y_size - 2);
+
+    void *texels    = NULL;
+    i32 pitch       = 0;
+    if(SDL_LockTexture(config.texture, NULL, &texels, &pitch))
     {
-        for(u32 i = 0; i < config.dim_x; i++)
-        {
-            // Force the Clamping of the value between 0 and 1 
-            // and mul it by 2 to use the full palette
-            if(v_map[i][j] < REAL_TYPE(0.0))
-                value = 0;
-            else if(v_map[i][j] > REAL_TYPE(1.0))
-                value = 1;
-            else
-                value = (u32)(v_map[i][j] * REAL_TYPE(2.0) * REAL_TYPE(255.0));
-
-            u32 color = colormap[value];
-            pixels[j * config.dim_x + i] = color;
-        }
+        gs_error_print("Could not lock the texture : %s", SDL_GetError());
     }
 
-    SDL_UpdateTexture(config.texture, NULL, pixels, (i32)(config.dim_x * sizeof(*pixels)));
-    SDL_Delay(5);
+    const viewport_t view = current_view(&config);
+    colorize(chemical, &view, &config.buffers, texels, (u64)pitch, config.dim_x, config.dim_y);
+
+    SDL_UnlockTexture(config.texture);
     SDL_RenderClear(config.renderer);
     SDL_RenderCopy(config.renderer, config.texture, NULL, NULL);
     SDL_RenderPresent(config.renderer);
-    free(pixels);
 }
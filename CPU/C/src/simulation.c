@@ -2,6 +2,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdalign.h>
+#include <sys/mman.h>
 
 #include <omp.h>
 
@@ -9,45 +10,56 @@
 #include "simulation.h"
 #include "logs.h"
 
-// Replace 256 by computed SIMD_VECTOR_LEN of the arch
-#define SIMD_LEN        (256ULL/8ULL)
-#define SIMD_WIDTH      (SIMD_LEN/sizeof(real))//4
+// Vector lengths (in bytes) a kernel is instantiated for, 
+// the lane count of a chemicals_t is VECTOR_LEN/sizeof(real)
+#define SSE_LEN         (128ULL/8ULL)
+#define AVX2_LEN        (256ULL/8ULL)
+#define AVX512_LEN      (512ULL/8ULL)
 
 // These shall be static const
 #define SIMD_OFFSET_X   1ULL
 #define SIMD_OFFSET_Y   1ULL
 
-/// This shall be deducted from simd size
+// Widest vector length, so that any layout is aligned 
 #define ALIGNMENT       64ULL
+// Transparent huge page size on x86_64
+#define HUGE_PAGE_SIZE  (2ULL * 1024ULL * 1024ULL)
 // Shall be computed
 #define BLOCK_SIZE_X    64ULL
 #define BLOCK_SIZE_Y    64ULL
+
+// Tile size of the temporally blocked sweep, halos excluded, so that the
+// four scratch planes of a tile stay in L2 for a few fused steps
+#define TBLOCK_SIZE_X   32ULL
+#define TBLOCK_SIZE_Y   128ULL
                 
-#define aligned_3D_span(base, field, dim2)                                      \
+#define aligned_3D_span(base, field, dim2, dim3)                                \
     __builtin_assume_aligned(                                                   \
-        make_3D_span(real, restrict, (base)->field, (base)->dim2, SIMD_WIDTH)   \
+        make_3D_span(real, restrict, (base)->field, (base)->dim2, dim3)         \
         , ALIGNMENT                                                             \
     );
  
 static inline void update_top_bottom(chemicals_t *uv)
 { 
-    real (*restrict u_span)[uv->y_size][SIMD_WIDTH]
-        = aligned_3D_span(uv, u, y_size);
+    const u64 simd_width = uv->simd_width;
+
+    real (*restrict u_span)[uv->y_size][simd_width]
+        = aligned_3D_span(uv, u, y_size, simd_width);
 
-    real (*restrict v_span)[uv->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(uv, v, y_size);
+    real (*restrict v_span)[uv->y_size][simd_width] 
+        = aligned_3D_span(uv, v, y_size, simd_width);
    
     #pragma omp parallel for 
     for(u64 j = SIMD_OFFSET_Y; j < uv->y_size - SIMD_OFFSET_Y; j++)
     {
-        for(u64 k = 0; k < SIMD_WIDTH-1; k++)
+        for(u64 k = 0; k < simd_width-1; k++)
         {
             u_span[0][j][k + 1] = u_span[uv->x_size - 2][j][k];
             u_span[uv->x_size - 1][j][k] = u_span[1][j][k + 1];
 
         }
 
-        for(u64 k = 0; k < SIMD_WIDTH-1; k++)
+        for(u64 k = 0; k < simd_width-1; k++)
         {
             v_span[0][j][k + 1] = v_span[uv->x_size - 2][j][k];
             v_span[uv->x_size - 1][j][k] = v_span[1][j][k + 1];
@@ -55,67 +67,290 @@ static inline void update_top_bottom(chemicals_t *uv)
     }
 }
 
-chemicals_t new_chemicals(u64 x, u64 y) 
+// Rows past num_rows only pad the last lanes up to a full vector, 
+// they are part of the zero boundary and are reset after every sweep
+static inline void clear_padding(chemicals_t *uv)
 {
-    assert(x % SIMD_WIDTH == 0);
-    assert(y % SIMD_WIDTH == 0);
- 
-    chemicals_t uv;
-    uv.nb_members = 2;
- 
-    u64 num_center_rows = x / SIMD_WIDTH;  
-    u64 simd_x_size     = num_center_rows + 2;
-    u64 simd_y_size     = (y + 2); // * SIMD_WIDTH;
+    const u64 simd_width        = uv->simd_width;
+    const u64 num_center_rows   = uv->x_size - 2 * SIMD_OFFSET_X;
+    const u64 last_lane_start   = (simd_width - 1) * num_center_rows;
 
-    uv.x_size = simd_x_size;
-    uv.y_size = simd_y_size; 
+    if(uv->num_rows >= last_lane_start + num_center_rows)
+        return;
+
+    real (*restrict u_span)[uv->y_size][simd_width]
+        = aligned_3D_span(uv, u, y_size, simd_width);
+
+    real (*restrict v_span)[uv->y_size][simd_width] 
+        = aligned_3D_span(uv, v, y_size, simd_width);
+
+    // First center row holding padding in the last lane
+    const u64 first_i = (uv->num_rows > last_lane_start) ? 
+                         uv->num_rows - last_lane_start + SIMD_OFFSET_X : SIMD_OFFSET_X;
+
+    for(u64 i = first_i; i < uv->x_size - SIMD_OFFSET_X; i++)
+    {
+        for(u64 j = SIMD_OFFSET_Y; j < uv->y_size - SIMD_OFFSET_Y; j++)
+        {
+            for(u64 k = 0; k < simd_width; k++)
+            {
+                if(i - 1 + k * num_center_rows < uv->num_rows)
+                    continue;
+
+                u_span[i][j][k] = REAL_TYPE(0.0);
+                v_span[i][j][k] = REAL_TYPE(0.0);
+            }
+        }
+    }
+}
+
+static inline u64 is_supported_width(u64 width)
+{
+    return (width == SSE_LEN / sizeof(real)) 
+        || (width == AVX2_LEN / sizeof(real)) 
+        || (width == AVX512_LEN / sizeof(real));
+}
+
+// Widest vector length supported by the running cpu, 
+// it can be lowered through the GS_SIMD_WIDTH environment variable
+u64 detect_simd_width(void)
+{
+    static u64 width = 0;
+    if(width)
+        return width;
+
+    width = SSE_LEN / sizeof(real);
+#if defined(__x86_64__) || defined(__i386__)
+    // The features of the target attributes of the kernels
+    __builtin_cpu_init();
+    const u8 has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(has_avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        width = AVX512_LEN / sizeof(real);
+    else if(has_avx2)
+        width = AVX2_LEN / sizeof(real);
+#endif
+
+    const char *env = getenv("GS_SIMD_WIDTH");
+    if(env)
+    {
+        u64 forced = strtoul(env, NULL, 10);
+        if(!is_supported_width(forced) || (forced > width))
+        {
+            gs_warn_print("GS_SIMD_WIDTH=%s is not supported, using %lld lanes", env, width);
+        }
+        else
+        {
+            width = forced;
+        }
+    }
+
+    gs_debug_print("SIMD width : %lld lanes", width);
+    return width;
+}
+
+static u8 huge_pages = 0;
+
+void use_huge_pages(u8 enable)
+{
+    huge_pages = enable;
+}
+
+// Products of the parameters used by STENCIL_OPERATION, computed once so
+// that a kernel does no more operations than with compile time constants
+typedef struct coefficients_s
+{
+    real feed;
+    real feed_kill;
+    real diffusion_u;
+    real diffusion_v;
+    real delta_t;
+} coefficients_t;
+
+static coefficients_t coefficients = 
+{
+    FEEDRATE, FEEDRATE + KILLRATE, DIFFUSION_RATE_U, DIFFUSION_RATE_V, DELTA_T
+};
+
+params_t default_params(void)
+{
+    return (params_t){ FEEDRATE, KILLRATE, DIFFUSION_RATE_U, DIFFUSION_RATE_V, DELTA_T };
+}
+
+void use_params(params_t const *params)
+{
+    if((params->feed_rate < 0) || (params->kill_rate < 0) 
+    || (params->diffusion_u < 0) || (params->diffusion_v < 0)
+    || (params->delta_t <= 0))
+    {
+        gs_error_print("Invalid parameters F = %g, k = %g, Du = %g, Dv = %g, dt = %g",
+                       params->feed_rate, params->kill_rate, params->diffusion_u,
+                       params->diffusion_v, params->delta_t);
+    }
+
+    // Explicit Euler keeps the diffusion positive up to dt * D * center = 1
+    const real diffusion = (params->diffusion_u > params->diffusion_v) ?
+                            params->diffusion_u : params->diffusion_v;
+    if(params->delta_t * diffusion * STENCIL_CENTER_WEIGHT > REAL_TYPE(1.0))
+    {
+        gs_warn_print("dt = %g is above the stability limit %g of the diffusion",
+                      params->delta_t, REAL_TYPE(1.0) / (diffusion * STENCIL_CENTER_WEIGHT));
+    }
+
+    coefficients.feed           = params->feed_rate;
+    coefficients.feed_kill      = params->feed_rate + params->kill_rate;
+    coefficients.diffusion_u    = params->diffusion_u;
+    coefficients.diffusion_v    = params->diffusion_v;
+    coefficients.delta_t        = params->delta_t;
+}
+
+// Zeroes the rows of both members with the static schedule of the stencil
+// sweep, so that on a NUMA system every page is first touched by the 
+// thread (hence the node) that will later compute it
+static void first_touch(chemicals_t *uv, u64 plane_size)
+{
+    const u64 row_size  = uv->y_size * uv->simd_width;
+    const u64 row_bytes = row_size * sizeof(real);
+
+    const u64 nb_x      = (uv->x_size - 2 * SIMD_OFFSET_X) / BLOCK_SIZE_X;
+    const u64 last_bi   = SIMD_OFFSET_X + nb_x * BLOCK_SIZE_X;
+    const u64 last_i    = uv->x_size - SIMD_OFFSET_X;
+
+    real *restrict u = uv->u;
+    real *restrict v = uv->v;
+
+    #pragma omp parallel
+    {
+        #pragma omp for schedule(static) nowait
+        for(u64 bi = 0; bi < nb_x; ++bi)
+        {
+            const u64 i0 = SIMD_OFFSET_X + bi * BLOCK_SIZE_X;
+            memset(u + i0 * row_size, 0, BLOCK_SIZE_X * row_bytes);
+            memset(v + i0 * row_size, 0, BLOCK_SIZE_X * row_bytes);
+        }
+
+        #pragma omp for schedule(static) nowait
+        for(u64 i = last_bi; i < last_i; ++i)
+        {
+            memset(u + i * row_size, 0, row_bytes);
+            memset(v + i * row_size, 0, row_bytes);
+        }
+
+        // Ghost rows and alignment padding
+        #pragma omp single nowait
+        {
+            const u64 tail_bytes = (plane_size - last_i * row_size) * sizeof(real);
+            memset(u, 0, row_bytes);
+            memset(v, 0, row_bytes);
+            memset(u + last_i * row_size, 0, tail_bytes);
+            memset(v + last_i * row_size, 0, tail_bytes);
+        }
+    }
+}
+
+static real *alloc_mesh(u64 bytes_size)
+{
+    real *data = NULL;
+
+    if(huge_pages)
+    {
+        bytes_size = ((bytes_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+        data = (real *)aligned_alloc(HUGE_PAGE_SIZE, bytes_size);
+
+        // Has to happen before the first touch to get huge pages right away
+        if(data && madvise(data, bytes_size, MADV_HUGEPAGE))
+        {
+            gs_warn_print("madvise(MADV_HUGEPAGE) failed for %lld bytes", bytes_size);
+        }
+    }
+    else
+    {
+        data = (real *)aligned_alloc(ALIGNMENT, bytes_size);
+    }
 
-    u64 size = (uv.x_size * (uv.y_size * SIMD_WIDTH));
-    u64 bytes_size = uv.nb_members * (size * sizeof(real));
-    
-    assert(bytes_size % ALIGNMENT == 0);
-    real *data = (real *)aligned_alloc(ALIGNMENT, bytes_size);
     if(!data)
     {
         gs_error_print("Could not allocate %lld bytes for the mesh", bytes_size);
     }
-    memset(data, 0, bytes_size);
+    return data;
+}
+
+// Allocates u and v in a single block, each of them being aligned
+static chemicals_t alloc_chemicals(u64 x_size, u64 y_size, u64 simd_width, 
+                                   u64 num_rows)
+{
+    chemicals_t uv;
+    uv.nb_members   = 2;
+    uv.num_rows     = num_rows;
+    uv.x_size       = x_size;
+    uv.y_size       = y_size;
+    uv.simd_width   = simd_width;
+
+    // Rounded up so that v starts on an aligned address as well
+    const u64 align_elems   = ALIGNMENT / sizeof(real);
+    u64 size = (uv.x_size * (uv.y_size * simd_width));
+    size = ((size + align_elems - 1) / align_elems) * align_elems;
+    u64 bytes_size = uv.nb_members * (size * sizeof(real));
+    
+    assert(bytes_size % ALIGNMENT == 0);
+    real *data = alloc_mesh(bytes_size);
 
     //Legal with restrict as per 
     // https://en.cppreference.com/w/c/language/restrict
     uv.u = (data);
     uv.v = (data + size);
 
+    first_touch(&uv, size);
+    return uv;
+}
+
+chemicals_t new_chemicals(u64 x, u64 y) 
+{
+    return new_chemicals_block(x, y, 0, y);
+}
+
+// Columns [col_start, col_start + nb_cols) of the initial (x, y) grid
+chemicals_t new_chemicals_block(u64 x, u64 y, u64 col_start, u64 nb_cols)
+{
+    assert(col_start + nb_cols <= y);
+    const u64 simd_w = detect_simd_width();
+ 
+    // The last lanes are padded when x is not a multiple of the width
+    u64 num_center_rows = (x + simd_w - 1) / simd_w;  
+    u64 simd_x_size     = num_center_rows + 2;
+    u64 simd_y_size     = (nb_cols + 2);
+
+    chemicals_t uv = alloc_chemicals(simd_x_size, simd_y_size, simd_w, x);
+
     u64 x_start  = ((7 * x) / 16) - 4;
     u64 x_end    = ((8 * x) / 16) - 4;
     u64 y_start  = (7 * y) / 16;
     u64 y_end    = (8 * y) / 16;
 
     // Need to check but it s normally legal to do so 
-    real (*restrict u_span)[uv.y_size][SIMD_WIDTH] 
-        = aligned_3D_span(&uv, u, y_size);
+    real (*restrict u_span)[uv.y_size][simd_w] 
+        = aligned_3D_span(&uv, u, y_size, simd_w);
 
-    real (*restrict v_span)[uv.y_size][SIMD_WIDTH] 
-        = aligned_3D_span(&uv, v, y_size);
+    real (*restrict v_span)[uv.y_size][simd_w] 
+        = aligned_3D_span(&uv, v, y_size, simd_w);
 
-    #pragma omp parallel for simd aligned(u_span, v_span) simdlen(SIMD_WIDTH) \
-    schedule(static, BLOCK_SIZE_X) 
+    #pragma omp parallel for schedule(static, BLOCK_SIZE_X) 
     for(u64 simd_i = SIMD_OFFSET_X; simd_i < simd_x_size - SIMD_OFFSET_X; simd_i++)
     {
         for(u64 simd_j = SIMD_OFFSET_Y; simd_j < simd_y_size - SIMD_OFFSET_Y; simd_j++)
         {   
-            for(u64 k = 0; k < SIMD_WIDTH; k++)
+            for(u64 k = 0; k < simd_w; k++)
             {   
                 u64 scalar_row = simd_i - 1 + k * num_center_rows;
-                u64 scalar_col = simd_j - 1;
+                u64 scalar_col = simd_j - 1 + col_start;
 
                 real pattern = (real)( scalar_row >= x_start 
                                     && scalar_row <  x_end 
                                     && scalar_col >= y_start 
                                     && scalar_col <  y_end);
+                real inside  = (real)(scalar_row < x);
                 
-                u_span[simd_i][simd_j][k] = REAL_TYPE(1.0) - pattern;
-                v_span[simd_i][simd_j][k] = pattern;
+                u_span[simd_i][simd_j][k] = inside * (REAL_TYPE(1.0) - pattern);
+                v_span[simd_i][simd_j][k] = inside * pattern;
             }
         }
     }
@@ -126,38 +361,21 @@ chemicals_t new_chemicals(u64 x, u64 y)
 
 chemicals_t zeros_chemicals(u64 x, u64 y)
 {
-    assert(x % SIMD_WIDTH == 0);
-    assert(y % SIMD_WIDTH == 0);
+    const u64 simd_w = detect_simd_width();
 
-    chemicals_t uv;
-    uv.nb_members = 2;
-
-    uv.x_size = (x/SIMD_WIDTH) + 2 ;
-    uv.y_size = (y + 2); 
-
-    u64 size = (uv.x_size * (uv.y_size * SIMD_WIDTH));
-    u64 bytes_size = uv.nb_members * (size * sizeof(real));
-    
-    real *data = (real *)aligned_alloc(ALIGNMENT, bytes_size);
-    if(!data)
-    {
-        gs_error_print("Could not allocate %lld bytes for the mesh", bytes_size);
-    }
-    memset(data, 0, bytes_size); 
-
-    uv.u = (data);
-    uv.v = (data + size);
-    
-    return uv;
+    return alloc_chemicals(((x + simd_w - 1) / simd_w) + 2, (y + 2), simd_w, x);
 }
 
 chemicals_t to_scalar_layout(chemicals_t const *chem_in) 
 {
     chemicals_t uv;
     uv.nb_members = chem_in->nb_members;
+    uv.simd_width = 1;
+    uv.num_rows   = chem_in->num_rows;
    
+    const u64 simd_w    = chem_in->simd_width;
     u64 num_center_rows = chem_in->x_size - 2;
-    u64 scalar_x_size   = num_center_rows * SIMD_WIDTH; 
+    u64 scalar_x_size   = chem_in->num_rows; 
     u64 scalar_y_size   = chem_in->y_size - 2; 
 
     uv.x_size = scalar_x_size;            
@@ -167,7 +385,8 @@ chemicals_t to_scalar_layout(chemicals_t const *chem_in)
     u64 bytes_size = uv.nb_members * (size * sizeof(real));
 
     // We might want to have a scalar_alignment
-    real *data = (real *)aligned_alloc(ALIGNMENT, bytes_size);
+    real *data = (real *)aligned_alloc(ALIGNMENT, 
+                    ((bytes_size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT);
     if(!data)
     {
         gs_error_print("Could not allocate %lld bytes for the mesh", bytes_size);
@@ -182,21 +401,23 @@ chemicals_t to_scalar_layout(chemicals_t const *chem_in)
     real (*restrict v_out)[uv.y_size] 
         = make_2D_span(real, restrict, uv.v, uv.y_size);
 
-    const real (*restrict u_in)[chem_in->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(chem_in, u, y_size);
+    const real (*restrict u_in)[chem_in->y_size][simd_w] 
+        = aligned_3D_span(chem_in, u, y_size, simd_w);
     
-    const real (*restrict v_in)[chem_in->y_size][SIMD_WIDTH]
-        = aligned_3D_span(chem_in, v, y_size);
+    const real (*restrict v_in)[chem_in->y_size][simd_w]
+        = aligned_3D_span(chem_in, v, y_size, simd_w);
 
     //#pragma omp parallel for schedule(static, BLOCK_SIZE_X)
     for(u64 simd_i = SIMD_OFFSET_X; simd_i < chem_in->x_size - SIMD_OFFSET_X; simd_i++)
     {
         for(u64 simd_j = SIMD_OFFSET_Y; simd_j < chem_in->y_size - SIMD_OFFSET_Y; simd_j++)
         {   
-            for(u64 k = 0; k < SIMD_WIDTH; k++)
+            for(u64 k = 0; k < simd_w; k++)
             {   
                 u64 scalar_row = simd_i - 1 + k * num_center_rows;
                 u64 scalar_col = simd_j - 1;
+                if(scalar_row >= scalar_x_size)
+                    continue;
 
                 u_out[scalar_row][scalar_col] = u_in[simd_i][simd_j][k];
                 v_out[scalar_row][scalar_col] = v_in[simd_i][simd_j][k]; 
@@ -205,107 +426,264 @@ chemicals_t to_scalar_layout(chemicals_t const *chem_in)
     }
     return uv;
 }
+
+// Inverse of to_scalar_layout, lays a (num_rows, num_cols) scalar state out
+// with the lanes of the running cpu, as new_chemicals does
+chemicals_t from_scalar_layout(chemicals_t const *chem_in)
+{
+    assert(chem_in->simd_width == 1);
+
+    const u64 x = chem_in->x_size;
+    const u64 y = chem_in->y_size;
+
+    chemicals_t uv = zeros_chemicals(x, y);
+
+    const u64 simd_w            = uv.simd_width;
+    const u64 num_center_rows   = uv.x_size - 2;
+
+    real (*restrict u_out)[uv.y_size][simd_w] 
+        = aligned_3D_span(&uv, u, y_size, simd_w);
+
+    real (*restrict v_out)[uv.y_size][simd_w] 
+        = aligned_3D_span(&uv, v, y_size, simd_w);
+
+    const real (*restrict u_in)[y] = make_2D_span(real, restrict, chem_in->u, y);
+    const real (*restrict v_in)[y] = make_2D_span(real, restrict, chem_in->v, y);
+
+    #pragma omp parallel for schedule(static)
+    for(u64 simd_i = SIMD_OFFSET_X; simd_i < uv.x_size - SIMD_OFFSET_X; simd_i++)
+    {
+        for(u64 simd_j = SIMD_OFFSET_Y; simd_j < uv.y_size - SIMD_OFFSET_Y; simd_j++)
+        {
+            for(u64 k = 0; k < simd_w; k++)
+            {
+                u64 scalar_row = simd_i - 1 + k * num_center_rows;
+                if(scalar_row >= x)
+                    continue;
+
+                u_out[simd_i][simd_j][k] = u_in[scalar_row][simd_j - 1];
+                v_out[simd_i][simd_j][k] = v_in[scalar_row][simd_j - 1];
+            }
+        }
+    }
+
+    update_top_bottom(&uv);
+    return uv;
+}
                 
-#define STENCIL_OPERATION()                                                     \
+// Neighbours of the cell (i, j, k) of a span, summed by weight
+#define STENCIL_EDGES(span)                                                     \
+        (((span)[i-1][j  ][k] + (span)[i+1][j  ][k])                            \
+       + ((span)[i  ][j-1][k] + (span)[i  ][j+1][k]))
+
+#define STENCIL_CORNERS(span)                                                   \
+        (((span)[i-1][j-1][k] + (span)[i-1][j+1][k])                            \
+       + ((span)[i+1][j-1][k] + (span)[i+1][j+1][k]))
+
+#if STENCIL_POINTS == 5
+    #define STENCIL_LAPLACIAN(span, c)                                          \
+        (STENCIL_EDGE_WEIGHT * STENCIL_EDGES(span)                              \
+       - STENCIL_CENTER_WEIGHT * (c))
+#else
+    #define STENCIL_LAPLACIAN(span, c)                                          \
+        ((STENCIL_CORNER_WEIGHT * STENCIL_CORNERS(span)                         \
+        + STENCIL_EDGE_WEIGHT * STENCIL_EDGES(span))                            \
+       - STENCIL_CENTER_WEIGHT * (c))
+#endif
+
+// The coefficients are read from coef, a local copy of the kernel, but for
+// the feed rate and F + k which are given (a lane or a cell may have its own)
+#define STENCIL_OPERATION(feed, feed_kill)                                      \
 do {                                                                            \
         const real u = u_span[i][j][k];                                         \
         const real v = v_span[i][j][k];                                         \
         const real sq_uv = u * v * v;                                           \
                                                                                 \
-        real du = FEEDRATE * (REAL_TYPE(1.0) - u);                              \
-        real dv = REAL_TYPE(-1.0) * ((FEEDRATE + KILLRATE) * v);                \
+        real du = (feed) * (REAL_TYPE(1.0) - u);                                \
+        real dv = REAL_TYPE(-1.0) * ((feed_kill) * v);                          \
                                                                                 \
-        real full_u1 = STENCIL_WEIGHTS[0][0] * (u_span[i-1][j-1][k] - u);       \
-        real full_v1 = STENCIL_WEIGHTS[0][0] * (v_span[i-1][j-1][k] - v);       \
-        real full_u2 = STENCIL_WEIGHTS[0][1] * (u_span[i-1][j  ][k] - u);       \
-        real full_v2 = STENCIL_WEIGHTS[0][1] * (v_span[i-1][j  ][k] - v);       \
-        real full_u3 = STENCIL_WEIGHTS[0][2] * (u_span[i-1][j+1][k] - u);       \
-        real full_v3 = STENCIL_WEIGHTS[0][2] * (v_span[i-1][j+1][k] - v);       \
-        real full_u4 = STENCIL_WEIGHTS[1][0] * (u_span[i  ][j-1][k] - u);       \
-        real full_v4 = STENCIL_WEIGHTS[1][0] * (v_span[i  ][j-1][k] - v);       \
-        assert(STENCIL_WEIGHTS[1][1] == 0.0);                                   \
-        full_u1 += STENCIL_WEIGHTS[1][2] * (u_span[i  ][j+1][k] - u);           \
-        full_v1 += STENCIL_WEIGHTS[1][2] * (v_span[i  ][j+1][k] - v);           \
-        full_u2 += STENCIL_WEIGHTS[2][0] * (u_span[i+1][j-1][k] - u);           \
-        full_v2 += STENCIL_WEIGHTS[2][0] * (v_span[i+1][j-1][k] - v);           \
-        full_u3 += STENCIL_WEIGHTS[2][1] * (u_span[i+1][j  ][k] - u);           \
-        full_v3 += STENCIL_WEIGHTS[2][1] * (v_span[i+1][j  ][k] - v);           \
-        full_u4 += STENCIL_WEIGHTS[2][2] * (u_span[i+1][j+1][k] - u);           \
-        full_v4 += STENCIL_WEIGHTS[2][2] * (v_span[i+1][j+1][k] - v);           \
+        const real full_u = STENCIL_LAPLACIAN(u_span, u);                       \
+        const real full_v = STENCIL_LAPLACIAN(v_span, v);                       \
                                                                                 \
-        const real full_u = (full_u1 + full_u2) + (full_u3 + full_u4);          \
-        const real full_v = (full_v1 + full_v2) + (full_v3 + full_v4);          \
+        du += ((coef.diffusion_u * full_u) - sq_uv);                            \
+        dv += ((coef.diffusion_v * full_v) + sq_uv);                            \
+                                                                                \
+        u_span_out[i][j][k] = u + (du * coef.delta_t);                          \
+        v_span_out[i][j][k] = v + (dv * coef.delta_t);                          \
+} while(0)
+
+// Weights of the lanes of the row i of the layout : 1 for those holding a
+// row of the grid, 0 for the padding rows at the end of the last lanes
+#define LANE_MASK(lane_mask, i)                                                 \
+do {                                                                            \
+        const u64 valid_lanes = (num_rows - ((i) - SIMD_OFFSET_X)               \
+                              + num_center_rows - 1) / num_center_rows;         \
+        for(u64 k = 0; k < SIMD_WIDTH; ++k)                                     \
+            lane_mask[k] = (k < valid_lanes) ? REAL_TYPE(1.0) : REAL_TYPE(0.0); \
+} while(0)
+
+// Largest change of u and v of the cell STENCIL_OPERATION just computed,
+// folded into the lane k of max_delta
+#define STENCIL_CHANGE(max_delta, lane_mask)                                    \
+do {                                                                            \
+        const real delta_u = u_span_out[i][j][k] - u_span[i][j][k];             \
+        const real delta_v = v_span_out[i][j][k] - v_span[i][j][k];             \
                                                                                 \
-        du += ((DIFFUSION_RATE_U * full_u) - sq_uv);                            \
-        dv += ((DIFFUSION_RATE_V * full_v) + sq_uv);                            \
+        real delta = (delta_u < REAL_TYPE(0.0)) ? -delta_u : delta_u;           \
+        delta = ( delta_v > delta) ?  delta_v : delta;                          \
+        delta = (-delta_v > delta) ? -delta_v : delta;                          \
+        delta = delta * lane_mask[k];                                           \
                                                                                 \
-        u_span_out[i][j][k] = u + (du * DELTA_T);                               \
-        v_span_out[i][j][k] = v + (dv * DELTA_T);                               \
+        max_delta[k] = (delta > max_delta[k]) ? delta : max_delta[k];           \
 } while(0)
 
-void simulation_step(chemicals_t const* chem_in, chemicals_t* chem_out)
+// Column range [*first, *last) of a tile that lies inside the domain
+static inline void tile_valid_cols(u64 y_size, i64 gj0, u64 tile_cols, 
+                                   u64 *first, u64 *last)
 {
-    assert(chem_in->u && chem_out->u);
-    assert(chem_in->v && chem_out->v);
-    assert(chem_in->x_size == chem_out->x_size);
-    assert(chem_in->y_size == chem_out->y_size);
-   
-    const real (*restrict u_span)[chem_in->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(chem_in, u, y_size);
+    const i64 first_j = (i64)SIMD_OFFSET_Y - gj0;
+    const i64 last_j  = (i64)(y_size - SIMD_OFFSET_Y) - gj0;
 
-    const real (*restrict v_span)[chem_in->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(chem_in, v, y_size);
+    *first  = (first_j < 0) ? 0 : (u64)first_j;
+    *last   = (last_j > (i64)tile_cols) ? tile_cols : (u64)last_j;
+    if(*last < *first) *last = *first;
+}
 
-    real (*restrict u_span_out)[chem_out->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(chem_out, u, y_size);
+// One instance of the kernels per vector length, the attribute allows the
+// wider ones to be generated even if the binary targets a baseline ISA
+#if defined(__x86_64__) || defined(__i386__)
+    #define SSE_ATTR    __attribute__((target("sse4.2")))
+    #define AVX2_ATTR   __attribute__((target("avx2,fma")))
+    #define AVX512_ATTR __attribute__((target("avx512f,avx512vl,avx2,fma")))
+#else
+    #define SSE_ATTR
+    #define AVX2_ATTR
+    #define AVX512_ATTR
+#endif
+
+#define KERNEL_CAT(name, suffix)    name##_##suffix
+#define KERNEL_NAME(name, suffix)   KERNEL_CAT(name, suffix)
+#define KERNEL_FN(name)             KERNEL_NAME(name, KERNEL_SUFFIX)
+
+#define KERNEL_BYTES    SSE_LEN
+#define KERNEL_SUFFIX   sse
+#define KERNEL_ATTR     SSE_ATTR
+#include "simulation_kernel.h"
+
+#define KERNEL_BYTES    AVX2_LEN
+#define KERNEL_SUFFIX   avx2
+#define KERNEL_ATTR     AVX2_ATTR
+#include "simulation_kernel.h"
+
+#define KERNEL_BYTES    AVX512_LEN
+#define KERNEL_SUFFIX   avx512
+#define KERNEL_ATTR     AVX512_ATTR
+#include "simulation_kernel.h"
+
+typedef struct kernels_s
+{
+    u64 simd_width;
+    real (*step)(chemicals_t const*, chemicals_t*);
+    void (*steps_fused)(chemicals_t const*, chemicals_t*, u64);
+    void (*step_lanes)(chemicals_t const*, chemicals_t*, real const*, real const*);
+    real (*step_rates)(chemicals_t const*, chemicals_t*, rates_t const*);
+} kernels_t;
+
+static const kernels_t kernels_table[3] = 
+{
+    {SSE_LEN    / sizeof(real), simulation_step_sse   , simulation_steps_fused_sse   ,
+                                simulation_step_lanes_sse   , simulation_step_rates_sse   },
+    {AVX2_LEN   / sizeof(real), simulation_step_avx2  , simulation_steps_fused_avx2  ,
+                                simulation_step_lanes_avx2  , simulation_step_rates_avx2  },
+    {AVX512_LEN / sizeof(real), simulation_step_avx512, simulation_steps_fused_avx512,
+                                simulation_step_lanes_avx512, simulation_step_rates_avx512}
+};
+
+static inline kernels_t const* select_kernels(u64 simd_width)
+{
+    for(u64 i = 0; i < sizeof(kernels_table)/sizeof(kernels_table[0]); i++)
+    {
+        if(kernels_table[i].simd_width == simd_width)
+            return &kernels_table[i];
+    }
+    gs_error_print("No kernel for a SIMD width of %lld lanes", simd_width);
+}
 
-    real (*restrict v_span_out)[chem_out->y_size][SIMD_WIDTH] 
-        = aligned_3D_span(chem_out, v, y_size);
-  
-    const u64 nb_x      = (chem_in->x_size - 2 * SIMD_OFFSET_X) / BLOCK_SIZE_X; 
-    const u64 last_j    = chem_in->y_size - SIMD_OFFSET_Y;
+real simulation_step(chemicals_t const* chem_in, chemicals_t* chem_out)
+{
+    assert(chem_in->simd_width == chem_out->simd_width);
+    return select_kernels(chem_in->simd_width)->step(chem_in, chem_out);
+}
+
+void simulation_steps_fused(chemicals_t const* chem_in, chemicals_t* chem_out,
+                            u64 nb_steps)
+{
+    assert(chem_in->simd_width == chem_out->simd_width);
+    select_kernels(chem_in->simd_width)->steps_fused(chem_in, chem_out, nb_steps);
+}
 
+real simulation_step_rates(chemicals_t const* chem_in, chemicals_t* chem_out,
+                           rates_t const *rates)
+{
+    assert(chem_in->simd_width == chem_out->simd_width);
+    assert(rates->simd_width == chem_in->simd_width);
+    assert(rates->x_size == chem_in->x_size && rates->y_size == chem_in->y_size);
+    return select_kernels(chem_in->simd_width)->step_rates(chem_in, chem_out, rates);
+}
+
+void simulation_step_lanes(chemicals_t const* chem_in, chemicals_t* chem_out,
+                           real const *feed_rates, real const *kill_rates)
+{
+    assert(chem_in->simd_width == chem_out->simd_width);
+    assert(chem_in->simd_width <= AVX512_LEN / sizeof(real));
+
+    real feed_kill[AVX512_LEN / sizeof(real)];
+    for(u64 k = 0; k < chem_in->simd_width; k++)
+        feed_kill[k] = feed_rates[k] + kill_rates[k];
+
+    select_kernels(chem_in->simd_width)->step_lanes(chem_in, chem_out, feed_rates, feed_kill);
+}
+
+// Copies a state into a chemicals_t of the same layout, 
+// rows are split between threads with the schedule of first_touch
+void copy_chemicals(chemicals_t *dst, chemicals_t const *src)
+{
+    assert(dst->x_size == src->x_size && dst->y_size == src->y_size);
+    assert(dst->simd_width == src->simd_width);
+
+    const u64 row_size  = src->y_size * src->simd_width;
+    const u64 row_bytes = row_size * sizeof(real);
+
+    const u64 nb_x      = (src->x_size - 2 * SIMD_OFFSET_X) / BLOCK_SIZE_X;
     const u64 last_bi   = SIMD_OFFSET_X + nb_x * BLOCK_SIZE_X;
-    const u64 last_i    = chem_in->x_size - SIMD_OFFSET_X;
-    
+    const u64 last_i    = src->x_size - SIMD_OFFSET_X;
+
     #pragma omp parallel
     {
-        #pragma omp for nowait 
+        #pragma omp for schedule(static) nowait
         for(u64 bi = 0; bi < nb_x; ++bi)
         {
             const u64 i0 = SIMD_OFFSET_X + bi * BLOCK_SIZE_X;
-            const u64 i1 = i0 + BLOCK_SIZE_X;
-
-            for(u64 i = i0; i < i1; ++i)
-            {
-                for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
-                {
-                    #pragma omp simd aligned \
-                    (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
-                    for(u64 k = 0; k < SIMD_WIDTH; ++k)
-                    {
-                        STENCIL_OPERATION();
-                    }
-                }
-            }
+            memcpy(dst->u + i0 * row_size, src->u + i0 * row_size, BLOCK_SIZE_X * row_bytes);
+            memcpy(dst->v + i0 * row_size, src->v + i0 * row_size, BLOCK_SIZE_X * row_bytes);
         }
-       
-        // Tail loop 
-        #pragma omp for nowait 
+
+        #pragma omp for schedule(static) nowait
         for(u64 i = last_bi; i < last_i; ++i)
         {
-            for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
-            {
-                #pragma omp simd aligned \
-                (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
-                for(u64 k = 0; k < SIMD_WIDTH; ++k)
-                {
-                    STENCIL_OPERATION();
-                }
-            }
+            memcpy(dst->u + i * row_size, src->u + i * row_size, row_bytes);
+            memcpy(dst->v + i * row_size, src->v + i * row_size, row_bytes);
+        }
+
+        // Ghost rows
+        #pragma omp single nowait
+        {
+            memcpy(dst->u, src->u, row_bytes);
+            memcpy(dst->v, src->v, row_bytes);
+            memcpy(dst->u + last_i * row_size, src->u + last_i * row_size, row_bytes);
+            memcpy(dst->v + last_i * row_size, src->v + last_i * row_size, row_bytes);
         }
     }
-    update_top_bottom(chem_out);
 }
 
 void swap_chemicals(chemicals_t *chem_1, chemicals_t *chem_2)
@@ -322,32 +700,87 @@ void free_chemicals(chemicals_t *chemical)
     if(chemical->u ) free(chemical->u);
 }
 
+// The maps go through the layout change of the chemicals, then the kill
+// rate becomes F + k so that the kernel reads as many values per cell
+rates_t new_rates(u64 x, u64 y, real const *feed_rates, real const *kill_rates)
+{
+    chemicals_t scalar;
+    scalar.x_size       = x;
+    scalar.y_size       = y;
+    scalar.nb_members   = 2;
+    scalar.simd_width   = 1;
+    scalar.num_rows     = x;
+    scalar.u            = (real *)feed_rates;
+    scalar.v            = (real *)kill_rates;
+
+    chemicals_t maps = from_scalar_layout(&scalar);
+
+    const u64 size = maps.x_size * maps.y_size * maps.simd_width;
+    #pragma omp parallel for schedule(static)
+    for(u64 i = 0; i < size; i++)
+        maps.v[i] += maps.u[i];
+
+    rates_t rates;
+    rates.x_size        = maps.x_size;
+    rates.y_size        = maps.y_size;
+    rates.simd_width    = maps.simd_width;
+    rates.num_rows      = maps.num_rows;
+    rates.feed          = maps.u;
+    rates.feed_kill     = maps.v;
+    return rates;
+}
+
+// Both maps are a single block, as the members of a chemicals_t
+void free_rates(rates_t *rates)
+{
+    if(rates->feed) free(rates->feed);
+}
+
+// Raw dump of the full state, halos and padding included. The layout
+// (width, rows) is part of the header so that read_data gives it back as is
 void write_data(FILE *fp, chemicals_t const *chem)
 {
     fwrite(&chem->x_size    , sizeof(chem->x_size)      , 1, fp);
     fwrite(&chem->y_size    , sizeof(chem->y_size)      , 1, fp);
     fwrite(&chem->nb_members, sizeof(chem->nb_members)  , 1, fp);
+    fwrite(&chem->simd_width, sizeof(chem->simd_width)  , 1, fp);
+    fwrite(&chem->num_rows  , sizeof(chem->num_rows)    , 1, fp);
 
-    // Works as u is ptr to the begening of a long serie of aligned data
-    fwrite(chem->u, sizeof(*chem->u), chem->nb_members * chem->x_size * chem->y_size, fp);
+    // v does not follow u right away when u is padded for alignment
+    const u64 size = chem->x_size * chem->y_size * chem->simd_width;
+    fwrite(chem->u, sizeof(*chem->u), size, fp);
+    fwrite(chem->v, sizeof(*chem->v), size, fp);
 }
 
 chemicals_t read_data(FILE *fp)
 {
-    chemicals_t out;
-
-    fread(&out.x_size, sizeof(out.x_size)           , 1, fp);
-    fread(&out.y_size, sizeof(out.y_size)           , 1, fp);
-    fread(&out.nb_members, sizeof(out.nb_members)   , 1, fp); 
-  
-    u64 size = out.x_size * out.y_size;
-    u64 bytes_size = out.nb_members * size;
-    
-    real *data = (real *)aligned_alloc(ALIGNMENT, bytes_size); 
-    fread(data, sizeof(*data), bytes_size, fp);
+    u64 x_size, y_size, nb_members, width, num_rows;
+
+    if((fread(&x_size, sizeof(x_size)           , 1, fp) != 1)
+    || (fread(&y_size, sizeof(y_size)           , 1, fp) != 1)
+    || (fread(&nb_members, sizeof(nb_members)   , 1, fp) != 1)
+    || (fread(&width, sizeof(width)             , 1, fp) != 1)
+    || (fread(&num_rows, sizeof(num_rows)       , 1, fp) != 1))
+    {
+        gs_error_print("Truncated header while reading %s", "data");
+    }
 
-    out.u = (data);
-    out.v = (data + size);
+    if((nb_members != 2) || (x_size < 3) || (y_size < 3) || !is_supported_width(width)
+    || (num_rows > (x_size - 2) * width) || (num_rows + width <= (x_size - 2) * width)
+    || (y_size > (1ULL << 32)) || (x_size > (1ULL << 32)))
+    {
+        gs_error_print("Invalid layout while reading data : %lld x %lld x %lld lanes",
+                       x_size, y_size, width);
+    }
+
+    chemicals_t out = alloc_chemicals(x_size, y_size, width, num_rows);
+
+    const u64 size = x_size * y_size * width;
+    if((fread(out.u, sizeof(*out.u), size, fp) != size)
+    || (fread(out.v, sizeof(*out.v), size, fp) != size))
+    {
+        gs_error_print("Truncated data, %lld values expected per member", size);
+    }
 
     return out;
 }
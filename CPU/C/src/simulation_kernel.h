@@ -0,0 +1,502 @@
+// Kernels of the vertical-lane layout, instantiated once per vector width.
+// simulation.c includes this file after defining : 
+//  - KERNEL_BYTES  : the vector length in bytes
+//  - KERNEL_SUFFIX : the suffix of the generated functions
+//  - KERNEL_ATTR   : the target attribute of the generated functions
+// No include guard on purpose
+
+#define SIMD_WIDTH      (KERNEL_BYTES/sizeof(real))
+
+KERNEL_ATTR static real KERNEL_FN(simulation_step)(chemicals_t const* chem_in, chemicals_t* chem_out)
+{
+    assert(chem_in->u && chem_out->u);
+    assert(chem_in->v && chem_out->v);
+    assert(chem_in->x_size == chem_out->x_size);
+    assert(chem_in->y_size == chem_out->y_size);
+   
+    const real (*restrict u_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, u, y_size, SIMD_WIDTH);
+
+    const real (*restrict v_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, v, y_size, SIMD_WIDTH);
+
+    real (*restrict u_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, u, y_size, SIMD_WIDTH);
+
+    real (*restrict v_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, v, y_size, SIMD_WIDTH);
+  
+    const coefficients_t coef = coefficients;
+
+    const u64 nb_x      = (chem_in->x_size - 2 * SIMD_OFFSET_X) / BLOCK_SIZE_X; 
+    const u64 last_j    = chem_in->y_size - SIMD_OFFSET_Y;
+
+    const u64 last_bi   = SIMD_OFFSET_X + nb_x * BLOCK_SIZE_X;
+    const u64 last_i    = chem_in->x_size - SIMD_OFFSET_X;
+
+    const u64 num_center_rows   = chem_in->x_size - 2 * SIMD_OFFSET_X;
+    const u64 num_rows          = chem_in->num_rows;
+    real max_delta              = REAL_TYPE(0.0);
+    
+    // The schedule must stay the one of first_touch for the pages to be local
+    #pragma omp parallel reduction(max:max_delta)
+    {
+        real lane_delta[SIMD_WIDTH] = {0};
+
+        #pragma omp for schedule(static) nowait 
+        for(u64 bi = 0; bi < nb_x; ++bi)
+        {
+            const u64 i0 = SIMD_OFFSET_X + bi * BLOCK_SIZE_X;
+            const u64 i1 = i0 + BLOCK_SIZE_X;
+
+            for(u64 i = i0; i < i1; ++i)
+            {
+                real lane_mask[SIMD_WIDTH];
+                LANE_MASK(lane_mask, i);
+
+                for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
+                {
+                    #pragma omp simd aligned \
+                    (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
+                    for(u64 k = 0; k < SIMD_WIDTH; ++k)
+                    {
+                        STENCIL_OPERATION(coef.feed, coef.feed_kill);
+                        STENCIL_CHANGE(lane_delta, lane_mask);
+                    }
+                }
+            }
+        }
+       
+        // Tail loop 
+        #pragma omp for schedule(static) nowait 
+        for(u64 i = last_bi; i < last_i; ++i)
+        {
+            real lane_mask[SIMD_WIDTH];
+            LANE_MASK(lane_mask, i);
+
+            for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
+            {
+                #pragma omp simd aligned \
+                (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
+                for(u64 k = 0; k < SIMD_WIDTH; ++k)
+                {
+                    STENCIL_OPERATION(coef.feed, coef.feed_kill);
+                    STENCIL_CHANGE(lane_delta, lane_mask);
+                }
+            }
+        }
+
+        for(u64 k = 0; k < SIMD_WIDTH; ++k)
+            max_delta = (lane_delta[k] > max_delta) ? lane_delta[k] : max_delta;
+    }
+    clear_padding(chem_out);
+    update_top_bottom(chem_out);
+
+    return max_delta;
+}
+
+// Fills a (tile_rows x tile_cols) tile whose first cell sits at the global
+// position (gi0, gj0). Rows are resolved through the scalar row they hold in
+// each lane, so rows above/below the center ones are fetched from the
+// neighbouring lane instead of the ghost rows, and cells out of the domain
+// are zeroed (the boundary condition of the simulation)
+KERNEL_ATTR static void KERNEL_FN(load_tile)(chemicals_t const *chem, i64 gi0, i64 gj0,
+                      u64 tile_rows, u64 tile_cols, u64 tile_stride,
+                      real *restrict tile_u, real *restrict tile_v)
+{
+    const real (*restrict u_span)[chem->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem, u, y_size, SIMD_WIDTH);
+
+    const real (*restrict v_span)[chem->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem, v, y_size, SIMD_WIDTH);
+
+    real (*restrict t_u)[tile_stride][SIMD_WIDTH] 
+        = make_3D_span(real, restrict, tile_u, tile_stride, SIMD_WIDTH);
+
+    real (*restrict t_v)[tile_stride][SIMD_WIDTH] 
+        = make_3D_span(real, restrict, tile_v, tile_stride, SIMD_WIDTH);
+
+    const i64 num_center_rows   = (i64)chem->x_size - 2;
+    const i64 scalar_rows       = (i64)chem->num_rows;
+
+    u64 first_col, last_col;
+    tile_valid_cols(chem->y_size, gj0, tile_cols, &first_col, &last_col);
+    const u64 cell_bytes = SIMD_WIDTH * sizeof(real);
+
+    for(u64 ti = 0; ti < tile_rows; ti++)
+    {
+        const i64 gi = gi0 + (i64)ti;
+
+        memset(&t_u[ti][0][0], 0, first_col * cell_bytes);
+        memset(&t_v[ti][0][0], 0, first_col * cell_bytes);
+        memset(&t_u[ti][last_col][0], 0, (tile_cols - last_col) * cell_bytes);
+        memset(&t_v[ti][last_col][0], 0, (tile_cols - last_col) * cell_bytes);
+
+        if((gi >= 1) && (gi <= num_center_rows))
+        {
+            const i64 gj = gj0 + (i64)first_col;
+            memcpy(&t_u[ti][first_col][0], &u_span[gi][gj][0], 
+                   (last_col - first_col) * cell_bytes);
+            memcpy(&t_v[ti][first_col][0], &v_span[gi][gj][0], 
+                   (last_col - first_col) * cell_bytes);
+            continue;
+        }
+
+        for(u64 k = 0; k < SIMD_WIDTH; k++)
+        {
+            const i64 scalar_row = gi - 1 + (i64)k * num_center_rows;
+            const u8 out_row = (scalar_row < 0) || (scalar_row >= scalar_rows);
+
+            const i64 src_i = out_row ? 0 : (scalar_row % num_center_rows) + 1;
+            const i64 src_k = out_row ? 0 : scalar_row / num_center_rows;
+
+            for(u64 tj = first_col; tj < last_col; tj++)
+            {
+                const i64 gj = gj0 + (i64)tj;
+                t_u[ti][tj][k] = out_row ? REAL_TYPE(0.0) : u_span[src_i][gj][src_k];
+                t_v[ti][tj][k] = out_row ? REAL_TYPE(0.0) : v_span[src_i][gj][src_k];
+            }
+        }
+    }
+}
+
+// Forces back to zero the cells of a tile that lie out of the domain, the
+// stencil has been applied to them as to any other cell
+KERNEL_ATTR static void KERNEL_FN(clamp_tile)(u64 num_center_rows, u64 num_rows, 
+                       u64 y_size, i64 gi0, i64 gj0,
+                       u64 i0, u64 i1, u64 j0, u64 j1, u64 tile_stride,
+                       real *restrict tile_u, real *restrict tile_v)
+{
+    real (*restrict t_u)[tile_stride][SIMD_WIDTH] 
+        = make_3D_span(real, restrict, tile_u, tile_stride, SIMD_WIDTH);
+
+    real (*restrict t_v)[tile_stride][SIMD_WIDTH] 
+        = make_3D_span(real, restrict, tile_v, tile_stride, SIMD_WIDTH);
+
+    const i64 n             = (i64)num_center_rows;
+    const i64 scalar_rows   = (i64)num_rows;
+
+    u64 first_col, last_col;
+    tile_valid_cols(y_size, gj0, j1, &first_col, &last_col);
+    if(first_col < j0)   first_col = j0;
+    if(last_col  < j0)   last_col  = j0;
+
+    for(u64 ti = i0; ti < i1; ti++)
+    {
+        const i64 gi = gi0 + (i64)ti;
+
+        for(u64 tj = j0; tj < first_col; tj++)
+        {
+            for(u64 k = 0; k < SIMD_WIDTH; k++)
+            {
+                t_u[ti][tj][k] = REAL_TYPE(0.0);
+                t_v[ti][tj][k] = REAL_TYPE(0.0);
+            }
+        }
+
+        for(u64 tj = last_col; tj < j1; tj++)
+        {
+            for(u64 k = 0; k < SIMD_WIDTH; k++)
+            {
+                t_u[ti][tj][k] = REAL_TYPE(0.0);
+                t_v[ti][tj][k] = REAL_TYPE(0.0);
+            }
+        }
+
+        // Center rows only need a check when their last lane holds padding
+        if((gi >= 1) && (gi <= n) && (gi - 1 + (i64)(SIMD_WIDTH - 1) * n < scalar_rows))
+            continue;
+
+        for(u64 k = 0; k < SIMD_WIDTH; k++)
+        {
+            const i64 scalar_row = gi - 1 + (i64)k * n;
+            if((scalar_row >= 0) && (scalar_row < scalar_rows))
+                continue;
+
+            for(u64 tj = first_col; tj < last_col; tj++)
+            {
+                t_u[ti][tj][k] = REAL_TYPE(0.0);
+                t_v[ti][tj][k] = REAL_TYPE(0.0);
+            }
+        }
+    }
+}
+
+// Overlapped temporal blocking : every tile is loaded with a halo as wide as
+// the number of fused steps, then advanced nb_steps times in a private
+// scratch buffer, the valid region shrinking by one cell per step. Only the
+// center of the tile is written back, so the grid is streamed from memory
+// once per nb_steps instead of once per step.
+// The stencil is the same STENCIL_OPERATION as simulation_step, which makes
+// the result bit-identical to nb_steps calls of simulation_step.
+KERNEL_ATTR static void KERNEL_FN(simulation_steps_fused)(chemicals_t const* chem_in, 
+                                chemicals_t* chem_out, u64 nb_steps)
+{
+    assert(chem_in->u && chem_out->u);
+    assert(chem_in->v && chem_out->v);
+    assert(chem_in->x_size == chem_out->x_size);
+    assert(chem_in->y_size == chem_out->y_size);
+    assert(nb_steps > 0);
+
+    const u64 num_center_rows   = chem_in->x_size - 2 * SIMD_OFFSET_X;
+    const u64 num_center_cols   = chem_in->y_size - 2 * SIMD_OFFSET_Y;
+    
+    const coefficients_t coef = coefficients;
+
+    const u64 halo          = nb_steps;
+    const u64 tile_stride   = TBLOCK_SIZE_Y + 2 * halo;
+    const u64 tile_size     = (TBLOCK_SIZE_X + 2 * halo) * tile_stride * SIMD_WIDTH;
+    const u64 tile_bytes    = ((tile_size * sizeof(real) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+
+    const u64 nb_bx = (num_center_rows + TBLOCK_SIZE_X - 1) / TBLOCK_SIZE_X;
+    const u64 nb_by = (num_center_cols + TBLOCK_SIZE_Y - 1) / TBLOCK_SIZE_Y;
+
+    real (*restrict u_span_glob)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, u, y_size, SIMD_WIDTH);
+
+    real (*restrict v_span_glob)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, v, y_size, SIMD_WIDTH);
+
+    #pragma omp parallel
+    {
+        real *scratch = (real *)aligned_alloc(ALIGNMENT, 4 * tile_bytes);
+        if(!scratch)
+        {
+            gs_error_print("Could not allocate %lld bytes for the tiles", 4 * tile_bytes);
+        }
+
+        real *tile_u_in     = scratch;
+        real *tile_v_in     = scratch + 1 * (tile_bytes / sizeof(real));
+        real *tile_u_out    = scratch + 2 * (tile_bytes / sizeof(real));
+        real *tile_v_out    = scratch + 3 * (tile_bytes / sizeof(real));
+
+        #pragma omp for collapse(2) schedule(static)
+        for(u64 bi = 0; bi < nb_bx; ++bi)
+        {
+            for(u64 bj = 0; bj < nb_by; ++bj)
+            {
+                const u64 i0 = SIMD_OFFSET_X + bi * TBLOCK_SIZE_X;
+                const u64 j0 = SIMD_OFFSET_Y + bj * TBLOCK_SIZE_Y;
+                const u64 block_rows = (i0 + TBLOCK_SIZE_X <= num_center_rows + SIMD_OFFSET_X) ?
+                                        TBLOCK_SIZE_X : num_center_rows + SIMD_OFFSET_X - i0;
+                const u64 block_cols = (j0 + TBLOCK_SIZE_Y <= num_center_cols + SIMD_OFFSET_Y) ?
+                                        TBLOCK_SIZE_Y : num_center_cols + SIMD_OFFSET_Y - j0;
+
+                const u64 tile_rows = block_rows + 2 * halo;
+                const u64 tile_cols = block_cols + 2 * halo;
+                const i64 gi0 = (i64)i0 - (i64)halo;
+                const i64 gj0 = (i64)j0 - (i64)halo;
+
+                KERNEL_FN(load_tile)(chem_in, gi0, gj0, tile_rows, tile_cols, tile_stride,
+                          tile_u_in, tile_v_in);
+
+                for(u64 s = 1; s <= nb_steps; s++)
+                {
+                    const real (*restrict u_span)[tile_stride][SIMD_WIDTH] 
+                        = __builtin_assume_aligned(make_3D_span(real, restrict,
+                            tile_u_in, tile_stride, SIMD_WIDTH), ALIGNMENT);
+
+                    const real (*restrict v_span)[tile_stride][SIMD_WIDTH] 
+                        = __builtin_assume_aligned(make_3D_span(real, restrict,
+                            tile_v_in, tile_stride, SIMD_WIDTH), ALIGNMENT);
+
+                    real (*restrict u_span_out)[tile_stride][SIMD_WIDTH] 
+                        = __builtin_assume_aligned(make_3D_span(real, restrict,
+                            tile_u_out, tile_stride, SIMD_WIDTH), ALIGNMENT);
+
+                    real (*restrict v_span_out)[tile_stride][SIMD_WIDTH] 
+                        = __builtin_assume_aligned(make_3D_span(real, restrict,
+                            tile_v_out, tile_stride, SIMD_WIDTH), ALIGNMENT);
+
+                    for(u64 i = s; i < tile_rows - s; ++i)
+                    {
+                        for(u64 j = s; j < tile_cols - s; ++j)
+                        {
+                            #pragma omp simd aligned \
+                            (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
+                            for(u64 k = 0; k < SIMD_WIDTH; ++k)
+                            {
+                                STENCIL_OPERATION(coef.feed, coef.feed_kill);
+                            }
+                        }
+                    }
+
+                    KERNEL_FN(clamp_tile)(num_center_rows, chem_in->num_rows, 
+                               chem_in->y_size, gi0, gj0,
+                               s, tile_rows - s, s, tile_cols - s, tile_stride,
+                               tile_u_out, tile_v_out);
+
+                    real *tmp   = tile_u_in; 
+                    tile_u_in   = tile_u_out; 
+                    tile_u_out  = tmp;
+
+                    tmp         = tile_v_in; 
+                    tile_v_in   = tile_v_out; 
+                    tile_v_out  = tmp;
+                }
+
+                const real (*restrict t_u)[tile_stride][SIMD_WIDTH] 
+                    = make_3D_span(real, restrict, tile_u_in, tile_stride, SIMD_WIDTH);
+
+                const real (*restrict t_v)[tile_stride][SIMD_WIDTH] 
+                    = make_3D_span(real, restrict, tile_v_in, tile_stride, SIMD_WIDTH);
+
+                for(u64 i = 0; i < block_rows; ++i)
+                {
+                    memcpy(&u_span_glob[i0 + i][j0][0], &t_u[halo + i][halo][0], 
+                           block_cols * SIMD_WIDTH * sizeof(real));
+                    memcpy(&v_span_glob[i0 + i][j0][0], &t_v[halo + i][halo][0], 
+                           block_cols * SIMD_WIDTH * sizeof(real));
+                }
+            }
+        }
+
+        free(scratch);
+    }
+    update_top_bottom(chem_out);
+}
+
+// simulation_step with the feed rate and F + k of every cell, which adds
+// two planes to the traffic of a step
+KERNEL_ATTR static real KERNEL_FN(simulation_step_rates)(chemicals_t const* chem_in, 
+                                chemicals_t* chem_out, rates_t const *rates)
+{
+    assert(chem_in->u && chem_out->u);
+    assert(chem_in->v && chem_out->v);
+    assert(chem_in->x_size == chem_out->x_size);
+    assert(chem_in->y_size == chem_out->y_size);
+   
+    const real (*restrict u_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, u, y_size, SIMD_WIDTH);
+
+    const real (*restrict v_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, v, y_size, SIMD_WIDTH);
+
+    real (*restrict u_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, u, y_size, SIMD_WIDTH);
+
+    real (*restrict v_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, v, y_size, SIMD_WIDTH);
+
+    const real (*restrict feed_span)[rates->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(rates, feed, y_size, SIMD_WIDTH);
+
+    const real (*restrict feed_kill_span)[rates->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(rates, feed_kill, y_size, SIMD_WIDTH);
+
+    const coefficients_t coef = coefficients;
+
+    const u64 nb_x      = (chem_in->x_size - 2 * SIMD_OFFSET_X) / BLOCK_SIZE_X; 
+    const u64 last_j    = chem_in->y_size - SIMD_OFFSET_Y;
+
+    const u64 last_bi   = SIMD_OFFSET_X + nb_x * BLOCK_SIZE_X;
+    const u64 last_i    = chem_in->x_size - SIMD_OFFSET_X;
+
+    const u64 num_center_rows   = chem_in->x_size - 2 * SIMD_OFFSET_X;
+    const u64 num_rows          = chem_in->num_rows;
+    real max_delta              = REAL_TYPE(0.0);
+    
+    #pragma omp parallel reduction(max:max_delta)
+    {
+        real lane_delta[SIMD_WIDTH] = {0};
+
+        #pragma omp for schedule(static) nowait 
+        for(u64 bi = 0; bi < nb_x; ++bi)
+        {
+            const u64 i0 = SIMD_OFFSET_X + bi * BLOCK_SIZE_X;
+            const u64 i1 = i0 + BLOCK_SIZE_X;
+
+            for(u64 i = i0; i < i1; ++i)
+            {
+                real lane_mask[SIMD_WIDTH];
+                LANE_MASK(lane_mask, i);
+
+                for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
+                {
+                    #pragma omp simd aligned(u_span, v_span, u_span_out, v_span_out, \
+                                             feed_span, feed_kill_span) simdlen(SIMD_WIDTH)
+                    for(u64 k = 0; k < SIMD_WIDTH; ++k)
+                    {
+                        STENCIL_OPERATION(feed_span[i][j][k], feed_kill_span[i][j][k]);
+                        STENCIL_CHANGE(lane_delta, lane_mask);
+                    }
+                }
+            }
+        }
+       
+        // Tail loop 
+        #pragma omp for schedule(static) nowait 
+        for(u64 i = last_bi; i < last_i; ++i)
+        {
+            real lane_mask[SIMD_WIDTH];
+            LANE_MASK(lane_mask, i);
+
+            for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
+            {
+                #pragma omp simd aligned(u_span, v_span, u_span_out, v_span_out, \
+                                         feed_span, feed_kill_span) simdlen(SIMD_WIDTH)
+                for(u64 k = 0; k < SIMD_WIDTH; ++k)
+                {
+                    STENCIL_OPERATION(feed_span[i][j][k], feed_kill_span[i][j][k]);
+                    STENCIL_CHANGE(lane_delta, lane_mask);
+                }
+            }
+        }
+
+        for(u64 k = 0; k < SIMD_WIDTH; ++k)
+            max_delta = (lane_delta[k] > max_delta) ? lane_delta[k] : max_delta;
+    }
+    clear_padding(chem_out);
+    update_top_bottom(chem_out);
+
+    return max_delta;
+}
+
+// One step of independent grids, one per lane : the ghost rows are never
+// written, so each grid has the zero boundary on its four sides. Lane k uses
+// feed[k] and feed_kill[k]. Runs on the calling thread, a batch of grids 
+// being too small to be split
+KERNEL_ATTR static void KERNEL_FN(simulation_step_lanes)(chemicals_t const* chem_in, 
+                                chemicals_t* chem_out, real const *restrict feed, 
+                                real const *restrict feed_kill)
+{
+    assert(chem_in->u && chem_out->u);
+    assert(chem_in->v && chem_out->v);
+    assert(chem_in->x_size == chem_out->x_size);
+    assert(chem_in->y_size == chem_out->y_size);
+
+    const real (*restrict u_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, u, y_size, SIMD_WIDTH);
+
+    const real (*restrict v_span)[chem_in->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_in, v, y_size, SIMD_WIDTH);
+
+    real (*restrict u_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, u, y_size, SIMD_WIDTH);
+
+    real (*restrict v_span_out)[chem_out->y_size][SIMD_WIDTH] 
+        = aligned_3D_span(chem_out, v, y_size, SIMD_WIDTH);
+
+    const coefficients_t coef = coefficients;
+
+    const u64 last_i    = chem_in->x_size - SIMD_OFFSET_X;
+    const u64 last_j    = chem_in->y_size - SIMD_OFFSET_Y;
+
+    for(u64 i = SIMD_OFFSET_X; i < last_i; ++i)
+    {
+        for(u64 j = SIMD_OFFSET_Y; j < last_j; ++j)
+        {
+            #pragma omp simd aligned \
+            (u_span, v_span, u_span_out, v_span_out) simdlen(SIMD_WIDTH)
+            for(u64 k = 0; k < SIMD_WIDTH; ++k)
+            {
+                STENCIL_OPERATION(feed[k], feed_kill[k]);
+            }
+        }
+    }
+}
+
+#undef SIMD_WIDTH
+#undef KERNEL_BYTES
+#undef KERNEL_SUFFIX
+#undef KERNEL_ATTR
@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <omp.h>
+#include <zlib.h>
+
+#include "snapshot.h"
+#include "logs.h"
+
+// Chunks are sized to about a MiB of raw values
+#define SNAPSHOT_CHUNK_BYTES    (1ULL << 20)
+
+// The fields of the model stay in [-1, 1], the error bound of the
+// quantization holds over that range
+#define SNAPSHOT_QUANTIZE_RANGE 1.0
+
+// Largest rounding of a dequantized value of the range to a real, taken
+// off the half step so that the bound still holds once rounded
+#ifdef DOUBLE_PRECISION
+    #define SNAPSHOT_ROUNDING   (SNAPSHOT_QUANTIZE_RANGE * DBL_EPSILON)
+#else
+    #define SNAPSHOT_ROUNDING   (SNAPSHOT_QUANTIZE_RANGE * FLT_EPSILON)
+#endif
+
+static inline u64 align_up(u64 value, u64 alignment)
+{
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+// Copies scalar rows [row_start, row_start + nb_rows) of a member from the
+// vertical-lane layout, scalar row r lives in the lane r / n of row r % n + 1
+static void gather_rows(chemicals_t const *chem, u64 member, u64 row_start,
+                        u64 nb_rows, real *restrict out)
+{
+    const u64 simd_width        = chem->simd_width;
+    const u64 num_center_rows   = chem->x_size - 2;
+    const u64 num_cols          = chem->y_size - 2;
+
+    const real (*restrict span)[chem->y_size][simd_width]
+        = make_3D_span(real, restrict, member ? chem->v : chem->u,
+                       chem->y_size, simd_width);
+
+    for(u64 r = 0; r < nb_rows; r++)
+    {
+        const u64 scalar_row = row_start + r;
+        const u64 i = (scalar_row % num_center_rows) + 1;
+        const u64 k = scalar_row / num_center_rows;
+
+        for(u64 j = 0; j < num_cols; j++)
+            out[r * num_cols + j] = span[i][j + 1][k];
+    }
+}
+
+// Groups the n-th byte of every element together, floating point values
+// of a smooth field then share most of their high bytes
+static void shuffle_bytes(u8 const *restrict in, u8 *restrict out,
+                          u64 nb_elems, u64 elem_size)
+{
+    for(u64 e = 0; e < nb_elems; e++)
+    {
+        for(u64 b = 0; b < elem_size; b++)
+            out[b * nb_elems + e] = in[e * elem_size + b];
+    }
+}
+
+static void unshuffle_bytes(u8 const *restrict in, u8 *restrict out,
+                            u64 nb_elems, u64 elem_size)
+{
+    for(u64 b = 0; b < elem_size; b++)
+    {
+        for(u64 e = 0; e < nb_elems; e++)
+            out[e * elem_size + b] = in[b * nb_elems + e];
+    }
+}
+
+// The header holds the half step, values past the range of an i32 (only
+// reached by a diverging run) saturate instead of overflowing
+static void quantize(real const *restrict in, i32 *restrict out,
+                     u64 nb_elems, f64 error_bound)
+{
+    const f64 inv_step = 1.0 / (2.0 * error_bound);
+
+    #pragma omp simd
+    for(u64 e = 0; e < nb_elems; e++)
+    {
+        f64 x = (f64)in[e] * inv_step;
+        x = (x < (f64)INT32_MIN) ? (f64)INT32_MIN : x;
+        x = (x > (f64)INT32_MAX) ? (f64)INT32_MAX : x;
+        out[e] = (i32)lrint(x);
+    }
+}
+
+snapshot_t snapshot_create(char const *file_name, u64 num_rows, u64 num_cols,
+                           snapshot_codec_t codec, f64 error_bound)
+{
+    snapshot_t snap;
+
+    snap.fp = fopen(file_name, "wb");
+    if(!snap.fp)
+    {
+        gs_error_print("Couldn't open file : %s", file_name);
+    }
+
+    // The half step must leave room for the rounding, and the range must
+    // fit in the i32 of the quantized values
+    const f64 min_error_bound = fmax(2.0 * SNAPSHOT_ROUNDING, SNAPSHOT_ROUNDING 
+                                   + SNAPSHOT_QUANTIZE_RANGE / (2.0 * (f64)INT32_MAX));
+    if((codec == SNAPSHOT_QUANTIZE) && !(error_bound >= min_error_bound))
+    {
+        gs_error_print("The error bound to quantize must be at least %g, got %g", 
+                       min_error_bound, error_bound);
+    }
+
+    snapshot_header_t *header = &snap.header;
+    memset(header, 0, sizeof(*header));
+    header->magic       = SNAPSHOT_MAGIC;
+    header->version     = SNAPSHOT_VERSION;
+    header->real_size   = sizeof(real);
+    header->num_rows    = num_rows;
+    header->num_cols    = num_cols;
+    header->nb_members  = 2;
+    header->codec       = codec;
+    header->error_bound = (codec == SNAPSHOT_QUANTIZE) ? error_bound - SNAPSHOT_ROUNDING : 0.0;
+
+    const u64 row_bytes = num_cols * sizeof(real);
+    header->chunk_rows  = (row_bytes >= SNAPSHOT_CHUNK_BYTES) ? 1 : SNAPSHOT_CHUNK_BYTES / row_bytes;
+    if(header->chunk_rows > num_rows)
+        header->chunk_rows = num_rows;
+
+    const u64 chunks_per_member = (num_rows + header->chunk_rows - 1) / header->chunk_rows;
+    snap.nb_chunks = header->nb_members * chunks_per_member;
+
+    const u64 chunk_bytes = header->chunk_rows * row_bytes;
+    snap.chunk_capacity = (codec == SNAPSHOT_RAW) ? chunk_bytes
+                        : align_up(compressBound((uLong)chunk_bytes), SNAPSHOT_ALIGNMENT);
+
+    snap.chunk_data = (u8 *)aligned_alloc(SNAPSHOT_ALIGNMENT, 
+                        align_up(snap.nb_chunks * snap.chunk_capacity, SNAPSHOT_ALIGNMENT));
+    snap.chunks     = (snapshot_chunk_t *)malloc(snap.nb_chunks * sizeof(snapshot_chunk_t));
+    if(!snap.chunk_data || !snap.chunks)
+    {
+        gs_error_print("Could not allocate the %lld chunks of the snapshots", snap.nb_chunks);
+    }
+
+    snap.nb_frames      = 0;
+    snap.max_frames     = 64;
+    snap.frame_offsets  = (u64 *)malloc(snap.max_frames * sizeof(u64));
+    if(!snap.frame_offsets)
+    {
+        gs_error_print("Could not allocate the index of %lld frames", snap.max_frames);
+    }
+
+    fwrite(header, sizeof(*header), 1, snap.fp);
+    snap.file_offset = sizeof(*header);
+
+    return snap;
+}
+
+// Fills and encodes the chunk c of the frame in its own output slot
+static void encode_chunk(snapshot_t *snap, chemicals_t const *chem, u64 c,
+                         real *restrict values, u8 *restrict shuffled)
+{
+    snapshot_header_t const *header = &snap->header;
+
+    const u64 chunks_per_member = snap->nb_chunks / header->nb_members;
+    const u64 member    = c / chunks_per_member;
+    const u64 row_start = (c % chunks_per_member) * header->chunk_rows;
+    const u64 nb_rows   = (row_start + header->chunk_rows <= header->num_rows) ?
+                           header->chunk_rows : header->num_rows - row_start;
+    const u64 nb_elems  = nb_rows * header->num_cols;
+
+    u8 *out = snap->chunk_data + c * snap->chunk_capacity;
+
+    if(header->codec == SNAPSHOT_RAW)
+    {
+        gather_rows(chem, member, row_start, nb_rows, (real *)out);
+        snap->chunks[c].bytes = nb_elems * sizeof(real);
+        return;
+    }
+
+    gather_rows(chem, member, row_start, nb_rows, values);
+
+    // Buffers are swapped at every stage
+    u8 *src = (u8 *)values;
+    u8 *dst = shuffled;
+
+    u64 elem_size = sizeof(real);
+    if(header->codec == SNAPSHOT_QUANTIZE)
+    {
+        quantize(values, (i32 *)dst, nb_elems, header->error_bound);
+        elem_size = sizeof(i32);
+        dst = src;
+        src = shuffled;
+    }
+    shuffle_bytes(src, dst, nb_elems, elem_size);
+
+    uLongf compressed_bytes = (uLongf)snap->chunk_capacity;
+    if(compress2(out, &compressed_bytes, dst, (uLong)(nb_elems * elem_size),
+                 Z_BEST_SPEED) != Z_OK)
+    {
+        gs_error_print("Could not compress the chunk %lld of a frame", c);
+    }
+    snap->chunks[c].bytes = (u64)compressed_bytes;
+}
+
+void snapshot_write(snapshot_t *snap, chemicals_t const *chem, u64 step)
+{
+    assert(chem->num_rows == snap->header.num_rows);
+    assert(chem->y_size - 2 == snap->header.num_cols);
+
+    const u64 chunk_bytes = snap->header.chunk_rows * snap->header.num_cols * sizeof(real);
+
+    // Chunks are independent, they are encoded by all the threads
+    #pragma omp parallel
+    {
+        real *values    = NULL;
+        u8 *shuffled    = NULL;
+        if(snap->header.codec != SNAPSHOT_RAW)
+        {
+            values      = (real *)malloc(chunk_bytes);
+            shuffled    = (u8 *)malloc(chunk_bytes);
+            if(!values || !shuffled)
+            {
+                gs_error_print("Could not allocate %lld bytes to encode a chunk", 2 * chunk_bytes);
+            }
+        }
+
+        #pragma omp for schedule(dynamic)
+        for(u64 c = 0; c < snap->nb_chunks; c++)
+            encode_chunk(snap, chem, c, values, shuffled);
+
+        free(values);
+        free(shuffled);
+    }
+
+    u64 data_bytes = 0;
+    for(u64 c = 0; c < snap->nb_chunks; c++)
+    {
+        snap->chunks[c].offset = data_bytes;
+        data_bytes += snap->chunks[c].bytes;
+    }
+
+    snapshot_frame_t frame;
+    frame.step          = step;
+    frame.nb_chunks     = snap->nb_chunks;
+    frame.data_offset   = align_up(sizeof(frame) + snap->nb_chunks * sizeof(snapshot_chunk_t),
+                                   SNAPSHOT_ALIGNMENT);
+    frame.frame_bytes   = align_up(frame.data_offset + data_bytes, SNAPSHOT_ALIGNMENT);
+
+    static const u8 zeros[SNAPSHOT_ALIGNMENT] = {0};
+    const u64 table_end = sizeof(frame) + snap->nb_chunks * sizeof(snapshot_chunk_t);
+
+    fwrite(&frame, sizeof(frame), 1, snap->fp);
+    fwrite(snap->chunks, sizeof(snapshot_chunk_t), snap->nb_chunks, snap->fp);
+    fwrite(zeros, 1, frame.data_offset - table_end, snap->fp);
+
+    for(u64 c = 0; c < snap->nb_chunks; c++)
+        fwrite(snap->chunk_data + c * snap->chunk_capacity, 1, snap->chunks[c].bytes, snap->fp);
+    fwrite(zeros, 1, frame.frame_bytes - frame.data_offset - data_bytes, snap->fp);
+
+    if(snap->nb_frames == snap->max_frames)
+    {
+        snap->max_frames *= 2;
+        snap->frame_offsets = (u64 *)realloc(snap->frame_offsets, snap->max_frames * sizeof(u64));
+        if(!snap->frame_offsets)
+        {
+            gs_error_print("Could not allocate the index of %lld frames", snap->max_frames);
+        }
+    }
+    snap->frame_offsets[snap->nb_frames++] = snap->file_offset;
+    snap->file_offset += frame.frame_bytes;
+}
+
+void snapshot_close(snapshot_t *snap)
+{
+    snapshot_footer_t footer;
+    footer.index_offset = snap->file_offset;
+    footer.nb_frames    = snap->nb_frames;
+    footer.magic        = SNAPSHOT_MAGIC;
+
+    fwrite(snap->frame_offsets, sizeof(u64), snap->nb_frames, snap->fp);
+    fwrite(&footer, sizeof(footer), 1, snap->fp);
+
+    // On the disk before the file is closed, a checkpoint is renamed right after
+    fflush(snap->fp);
+    fsync(fileno(snap->fp));
+    fclose(snap->fp);
+
+    free(snap->frame_offsets);
+    free(snap->chunk_data);
+    free(snap->chunks);
+}
+
+static inline u64 chunks_per_member(snapshot_header_t const *header)
+{
+    return (header->num_rows + header->chunk_rows - 1) / header->chunk_rows;
+}
+
+// Rows held by the chunk c of a frame
+static inline u64 chunk_rows(snapshot_header_t const *header, u64 c)
+{
+    const u64 row_start = (c % chunks_per_member(header)) * header->chunk_rows;
+    return (row_start + header->chunk_rows <= header->num_rows) ?
+            header->chunk_rows : header->num_rows - row_start;
+}
+
+static u8 valid_header(snapshot_header_t const *header)
+{
+    return (header->magic == SNAPSHOT_MAGIC)
+        && (header->version == SNAPSHOT_VERSION)
+        && (header->real_size == sizeof(real))
+        && (header->codec <= SNAPSHOT_QUANTIZE)
+        && (header->nb_members == 2)
+        && (header->num_rows > 0) && (header->num_rows < (1ULL << 31))
+        && (header->num_cols > 0) && (header->num_cols < (1ULL << 31))
+        && (header->chunk_rows > 0) && (header->chunk_rows <= header->num_rows)
+        && ((header->codec != SNAPSHOT_QUANTIZE) || (header->error_bound > 0.0));
+}
+
+// Checks that the frame at offset and all of its chunks lie before end
+static u8 valid_frame(snapshot_reader_t const *reader, u64 offset, u64 end)
+{
+    snapshot_header_t const *header = &reader->header;
+
+    if((offset % SNAPSHOT_ALIGNMENT) || (offset > end) 
+    || (end - offset < sizeof(snapshot_frame_t)))
+        return 0;
+
+    snapshot_frame_t const *frame = (snapshot_frame_t const *)(reader->map + offset);
+    const u64 nb_chunks = header->nb_members * chunks_per_member(header);
+
+    if(frame->nb_chunks != nb_chunks)
+        return 0;
+
+    const u64 table_end = sizeof(*frame) + nb_chunks * sizeof(snapshot_chunk_t);
+    if((frame->data_offset < table_end) || (frame->frame_bytes < frame->data_offset)
+    || (frame->frame_bytes > end - offset) || (frame->frame_bytes % SNAPSHOT_ALIGNMENT))
+        return 0;
+
+    snapshot_chunk_t const *chunks = (snapshot_chunk_t const *)(frame + 1);
+    const u64 data_bytes = frame->frame_bytes - frame->data_offset;
+
+    u64 next = 0;
+    for(u64 c = 0; c < nb_chunks; c++)
+    {
+        if((chunks[c].offset > data_bytes) || (chunks[c].bytes > data_bytes - chunks[c].offset))
+            return 0;
+
+        // Views of raw frames rely on the planes being contiguous
+        const u64 raw_bytes = chunk_rows(header, c) * header->num_cols * sizeof(real);
+        if((header->codec == SNAPSHOT_RAW) 
+        && ((chunks[c].offset != next) || (chunks[c].bytes != raw_bytes)))
+            return 0;
+
+        next = chunks[c].offset + chunks[c].bytes;
+    }
+    return 1;
+}
+
+static void push_frame(snapshot_reader_t *reader, u64 *max_frames, u64 offset)
+{
+    if(reader->nb_frames == *max_frames)
+    {
+        *max_frames = (*max_frames) ? 2 * (*max_frames) : 64;
+        reader->frame_offsets = (u64 *)realloc(reader->frame_offsets, *max_frames * sizeof(u64));
+        if(!reader->frame_offsets)
+        {
+            gs_error_print("Could not allocate the index of %lld frames", *max_frames);
+        }
+    }
+    reader->frame_offsets[reader->nb_frames++] = offset;
+}
+
+snapshot_reader_t snapshot_open(char const *file_name)
+{
+    snapshot_reader_t reader;
+    reader.nb_frames        = 0;
+    reader.frame_offsets    = NULL;
+    reader.decoded          = NULL;
+
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0)
+    {
+        gs_error_print("Couldn't open file : %s", file_name);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) || ((u64)st.st_size < sizeof(snapshot_header_t)))
+    {
+        gs_error_print("%s is too small to be a snapshot file", file_name);
+    }
+    reader.map_bytes = (u64)st.st_size;
+
+    // Private writable mapping, a view can be modified without touching the file
+    reader.map = (u8 *)mmap(NULL, reader.map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(reader.map == MAP_FAILED)
+    {
+        gs_error_print("Could not map the %lld bytes of %s", reader.map_bytes, file_name);
+    }
+
+    memcpy(&reader.header, reader.map, sizeof(reader.header));
+    if(!valid_header(&reader.header))
+    {
+        gs_error_print("%s is not a valid snapshot file", file_name);
+    }
+
+    u64 max_frames = 0;
+    u64 data_end   = reader.map_bytes;
+
+    snapshot_footer_t footer;
+    memset(&footer, 0, sizeof(footer));
+    if(reader.map_bytes >= sizeof(snapshot_header_t) + sizeof(footer))
+        memcpy(&footer, reader.map + reader.map_bytes - sizeof(footer), sizeof(footer));
+
+    const u64 index_end = reader.map_bytes - sizeof(footer);
+    u8 indexed = (footer.magic == SNAPSHOT_MAGIC)
+              && (footer.index_offset >= sizeof(snapshot_header_t))
+              && (footer.index_offset <= index_end)
+              && (footer.nb_frames == (index_end - footer.index_offset) / sizeof(u64))
+              && ((index_end - footer.index_offset) % sizeof(u64) == 0);
+
+    if(indexed)
+    {
+        data_end = footer.index_offset;
+        u64 const *index = (u64 const *)(reader.map + footer.index_offset);
+
+        for(u64 f = 0; f < footer.nb_frames; f++)
+        {
+            if(!valid_frame(&reader, index[f], data_end))
+            {
+                gs_error_print("Frame %lld of %s is corrupted", f, file_name);
+            }
+            push_frame(&reader, &max_frames, index[f]);
+        }
+    }
+    else
+    {
+        // Interrupted run, frames are recovered up to the first broken one
+        u64 offset = sizeof(snapshot_header_t);
+        while(valid_frame(&reader, offset, data_end))
+        {
+            push_frame(&reader, &max_frames, offset);
+            offset += ((snapshot_frame_t const *)(reader.map + offset))->frame_bytes;
+        }
+        gs_warn_print("%s has no index, %lld frames recovered", file_name, reader.nb_frames);
+    }
+
+    return reader;
+}
+
+// Decodes a compressed chunk into its rows of the decoded frame
+static void decode_chunk(snapshot_reader_t const *reader, snapshot_frame_t const *frame,
+                         u64 c, u8 *restrict packed, u8 *restrict values)
+{
+    snapshot_header_t const *header = &reader->header;
+    snapshot_chunk_t const *chunk = (snapshot_chunk_t const *)(frame + 1) + c;
+
+    const u64 member    = c / chunks_per_member(header);
+    const u64 row_start = (c % chunks_per_member(header)) * header->chunk_rows;
+    const u64 nb_elems  = chunk_rows(header, c) * header->num_cols;
+    const u64 elem_size = (header->codec == SNAPSHOT_QUANTIZE) ? sizeof(i32) : sizeof(real);
+
+    real *out = reader->decoded + member * header->num_rows * header->num_cols
+                                + row_start * header->num_cols;
+
+    u8 const *src = (u8 const *)frame + frame->data_offset + chunk->offset;
+
+    uLongf raw_bytes = (uLongf)(nb_elems * elem_size);
+    if((uncompress(packed, &raw_bytes, src, (uLong)chunk->bytes) != Z_OK)
+    || (raw_bytes != nb_elems * elem_size))
+    {
+        gs_error_print("Chunk %lld of a frame is corrupted", c);
+    }
+
+    if(header->codec == SNAPSHOT_SHUFFLE)
+    {
+        unshuffle_bytes(packed, (u8 *)out, nb_elems, elem_size);
+        return;
+    }
+
+    unshuffle_bytes(packed, values, nb_elems, elem_size);
+
+    i32 const *quantized = (i32 const *)values;
+    const f64 step = 2.0 * header->error_bound;
+
+    #pragma omp simd
+    for(u64 e = 0; e < nb_elems; e++)
+        out[e] = (real)((f64)quantized[e] * step);
+}
+
+// Scalar layout view (x_size = num_rows, y_size = num_cols, no halos) of a
+// frame. Raw frames point into the mapping, compressed frames into a buffer
+// of the reader that the next call overwrites
+chemicals_t snapshot_frame(snapshot_reader_t *reader, u64 index, u64 *step)
+{
+    if(index >= reader->nb_frames)
+    {
+        gs_error_print("Frame %lld requested out of %lld", index, reader->nb_frames);
+    }
+
+    snapshot_header_t const *header = &reader->header;
+    snapshot_frame_t const *frame 
+        = (snapshot_frame_t const *)(reader->map + reader->frame_offsets[index]);
+
+    if(step)
+        *step = frame->step;
+
+    chemicals_t view;
+    view.nb_members = header->nb_members;
+    view.x_size     = header->num_rows;
+    view.y_size     = header->num_cols;
+    view.num_rows   = header->num_rows;
+    view.simd_width = 1;
+
+    const u64 plane_size = header->num_rows * header->num_cols;
+
+    if(header->codec == SNAPSHOT_RAW)
+    {
+        view.u = (real *)((u8 *)frame + frame->data_offset);
+        view.v = view.u + plane_size;
+        return view;
+    }
+
+    if(!reader->decoded)
+    {
+        reader->decoded = (real *)aligned_alloc(SNAPSHOT_ALIGNMENT,
+                            align_up(header->nb_members * plane_size * sizeof(real), SNAPSHOT_ALIGNMENT));
+        if(!reader->decoded)
+        {
+            gs_error_print("Could not allocate %lld values to decode a frame", 
+                           header->nb_members * plane_size);
+        }
+    }
+
+    const u64 chunk_bytes = header->chunk_rows * header->num_cols * sizeof(real);
+
+    #pragma omp parallel
+    {
+        u8 *packed  = (u8 *)malloc(chunk_bytes);
+        u8 *values  = (u8 *)malloc(chunk_bytes);
+        if(!packed || !values)
+        {
+            gs_error_print("Could not allocate %lld bytes to decode a chunk", 2 * chunk_bytes);
+        }
+
+        #pragma omp for schedule(dynamic)
+        for(u64 c = 0; c < frame->nb_chunks; c++)
+            decode_chunk(reader, frame, c, packed, values);
+
+        free(packed);
+        free(values);
+    }
+
+    view.u = reader->decoded;
+    view.v = reader->decoded + plane_size;
+    return view;
+}
+
+void snapshot_reader_close(snapshot_reader_t *reader)
+{
+    munmap(reader->map, reader->map_bytes);
+    free(reader->frame_offsets);
+    free(reader->decoded);
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <omp.h>
+
+#include "viewer.h"
+#include "logs.h"
+
+// The display polls the window at least that often while no frame comes
+#define POLL_PERIOD_NS  (16LL * 1000LL * 1000LL)
+
+// OpenMP team of the viewer thread, set once it has started the simulation
+#define RENDER_THREADS  2
+
+#define ALIGNMENT       64ULL
+
+static chemicals_t new_slot(chemicals_t const *like)
+{
+    chemicals_t slot    = *like;
+    slot.nb_members     = 1;
+    slot.u              = NULL;
+
+    const u64 bytes = like->x_size * like->y_size * like->simd_width * sizeof(real);
+    slot.v = (real *)aligned_alloc(ALIGNMENT, ((bytes + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT);
+    if(!slot.v)
+    {
+        gs_error_print("Could not allocate %lld bytes for a displayed frame", bytes);
+    }
+
+    memset(slot.v, 0, bytes);
+    return slot;
+}
+
+// Copies v in the back slot then makes it the newest frame,
+// returns 0 once the display asked to stop
+static u8 publish(viewer_t *viewer, chemicals_t const *chem, u64 step)
+{
+    chemicals_t *slot   = &viewer->slots[viewer->back];
+    const u64 row_size  = chem->y_size * chem->simd_width;
+
+    #pragma omp parallel for schedule(static)
+    for(u64 i = 0; i < chem->x_size; i++)
+        memcpy(slot->v + i * row_size, chem->v + i * row_size, row_size * sizeof(real));
+
+    pthread_mutex_lock(&viewer->lock);
+    viewer->steps[viewer->back] = step;
+
+    const u64 ready = viewer->ready;
+    viewer->ready   = viewer->back;
+    viewer->back    = ready;
+    viewer->fresh   = 1;
+    viewer->nb_published++;
+
+    const u8 stop = viewer->stop;
+    pthread_cond_signal(&viewer->published);
+    pthread_mutex_unlock(&viewer->lock);
+
+    return !stop;
+}
+
+// Same blocking as the batch mode : fused steps up to the next frame
+static void *simulation_loop(void *arg)
+{
+    viewer_t *viewer    = (viewer_t *)arg;
+    args_t const *args  = viewer->args;
+
+    u64 i = viewer->first_step;
+    while(i < args->steps)
+    {
+        u64 nb_steps = args->output_frequency - i % args->output_frequency;
+        if(nb_steps > args->steps - i)          nb_steps = args->steps - i;
+        if(nb_steps > args->temporal_block)     nb_steps = args->temporal_block;
+
+        if(viewer->rates)
+            simulation_step_rates(viewer->uv_in, viewer->uv_out, viewer->rates);
+        else if(nb_steps > 1)
+            simulation_steps_fused(viewer->uv_in, viewer->uv_out, nb_steps);
+        else
+            simulation_step(viewer->uv_in, viewer->uv_out);
+        swap_chemicals(viewer->uv_in, viewer->uv_out);
+
+        i += nb_steps;
+        if(((i % args->output_frequency == 0) || (i == args->steps))
+        && !publish(viewer, viewer->uv_in, i))
+            break;
+    }
+
+    pthread_mutex_lock(&viewer->lock);
+    viewer->last_step   = i;
+    viewer->done        = 1;
+    pthread_cond_signal(&viewer->published);
+    pthread_mutex_unlock(&viewer->lock);
+
+    return NULL;
+}
+
+// Returns 1 when the view moved
+static u8 poll_events(viewer_t *viewer, SDL_config_t *config)
+{
+    u8 moved = 0;
+
+    SDL_Event event;
+    while(SDL_PollEvent(&event))
+    {
+        if(event.type == SDL_QUIT)
+        {
+            pthread_mutex_lock(&viewer->lock);
+            viewer->stop = 1;
+            pthread_mutex_unlock(&viewer->lock);
+        }
+        else
+        {
+            moved |= render_handle_event(config, &event);
+        }
+    }
+    return moved;
+}
+
+void viewer_run(SDL_config_t config, args_t const *args, chemicals_t *uv_in,
+                chemicals_t *uv_out, rates_t const *rates, u64 first_step)
+{
+    viewer_t viewer;
+    memset(&viewer, 0, sizeof(viewer));
+
+    for(u64 s = 0; s < 3; s++)
+        viewer.slots[s] = new_slot(uv_in);
+
+    viewer.back         = 0;
+    viewer.ready        = 1;
+    viewer.front        = 2;
+    viewer.args         = args;
+    viewer.uv_in        = uv_in;
+    viewer.uv_out       = uv_out;
+    viewer.rates        = rates;
+    viewer.first_step   = first_step;
+    viewer.last_step    = first_step;
+
+    pthread_mutex_init(&viewer.lock, NULL);
+    pthread_cond_init(&viewer.published, NULL);
+
+    const f64 start = omp_get_wtime();
+    if(pthread_create(&viewer.thread, NULL, simulation_loop, &viewer))
+    {
+        gs_error_print("Could not start the simulation thread of the %s mode", "interactive");
+    }
+
+    // The number of threads only applies to the parallel regions of this thread
+    const int nb_threads = omp_get_max_threads();
+    omp_set_num_threads(RENDER_THREADS);
+
+    for(;;)
+    {
+        const u8 moved = poll_events(&viewer, &config);
+
+        pthread_mutex_lock(&viewer.lock);
+        if(!viewer.fresh && !viewer.done)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += POLL_PERIOD_NS;
+            if(deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec  += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&viewer.published, &viewer.lock, &deadline);
+        }
+
+        const u8 fresh = viewer.fresh;
+        const u8 done  = viewer.done;
+        if(fresh)
+        {
+            const u64 ready = viewer.ready;
+            viewer.ready    = viewer.front;
+            viewer.front    = ready;
+            viewer.fresh    = 0;
+        }
+        pthread_mutex_unlock(&viewer.lock);
+
+        // The front slot is only touched by this thread until the next swap,
+        // it is drawn again when the view moves between two frames
+        if(fresh || (moved && viewer.nb_presented))
+        {
+            render_gray_scott(config, &viewer.slots[viewer.front]);
+            viewer.nb_presented++;
+        }
+        else if(done)
+        {
+            break;
+        }
+    }
+
+    pthread_join(viewer.thread, NULL);
+    omp_set_num_threads(nb_threads);
+
+    gs_info_print("%lld steps in %.3lf s, %lld frames published, %lld presented",
+                  viewer.last_step - first_step, omp_get_wtime() - start,
+                  viewer.nb_published, viewer.nb_presented);
+
+    pthread_cond_destroy(&viewer.published);
+    pthread_mutex_destroy(&viewer.lock);
+
+    for(u64 s = 0; s < 3; s++)
+        free(viewer.slots[s].v);
+}